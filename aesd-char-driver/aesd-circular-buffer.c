@@ -11,33 +11,52 @@
 
 #ifdef __KERNEL__
 #include <linux/string.h>
+#include <linux/errno.h>
 #else
 #include <string.h>
+#include <errno.h>
 #endif
 
 #include "aesd-circular-buffer.h"
-// Writing this for coding convenience
-#define MAX_WRITE AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
-#ifdef __KERNEL__
+// Writing this for coding convenience, the capacity is set when the buffer is initialized
+#define MAX_WRITE (buffer->capacity)
+// Array index of the entry number places behind the oldest one
+#define ENTRY_INDEX(buffer, number) (((buffer)->out_offs + (number)) % (buffer)->capacity)
 /* Function: 	aesd_circular_buffer_llseek
  * Purpose:	find the position of the current offset, for which you need to find size till the current number and move the pointer to that location
+ * 		number counts from the oldest entry (out_offs), the same order read() returns them in
  * Parameters:	The circular buffer instance, how many buffers have been completed, offset position (where in the buffer is the current location)
- * Returns:	loff_t is a typedef for long long 64-bit data on gcc terminology	
+ * Returns:	loff_t is a typedef for long long 64-bit data on gcc terminology, -EINVAL when the entry or the offset does not exist
  */
 loff_t aesd_circular_buffer_llseek(struct aesd_circular_buffer *buffer, unsigned int number, unsigned int offset) {
-    int offset_for_the_current_entry = 0, i;
-    if ((number >= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED) || (offset >= buffer->entry[number].size)) {
+    struct aesd_buffer_entry *entry;
+    if (number >= (unsigned int) get_populated_nodes(buffer)) {
         return -EINVAL;
     }
-    for (i = 0; i < number; i++) {
-	if ((!(&buffer->entry[i])) || buffer->entry[i].size == 0) {
-            return -EINVAL;
-        }
-        offset_for_the_current_entry += buffer->entry[i].size;
+    entry = &buffer->entry[ENTRY_INDEX(buffer, number)];
+    if (offset >= entry->size) {
+        return -EINVAL;
     }
-    return (offset + offset_for_the_current_entry);
+    return (loff_t)(entry->start - buffer->base) + offset;
+}
+/* Function: 	aesd_circular_buffer_entries_end
+ * Purpose:	find the position just behind count entries starting at entry number, the end of a range read.
+ * 		The range is cut short at the newest entry when fewer entries exist.
+ * Parameters:	The circular buffer instance, first entry counted from the oldest, number of entries (at least 1)
+ * Returns:	the position, -EINVAL when entry number does not exist or count is 0
+ */
+loff_t aesd_circular_buffer_entries_end(struct aesd_circular_buffer *buffer, unsigned int number, unsigned int count) {
+    struct aesd_buffer_entry *last;
+    unsigned int populated = get_populated_nodes(buffer);
+    if ((number >= populated) || (count == 0)) {
+        return -EINVAL;
+    }
+    if (count > populated - number) {
+        count = populated - number;
+    }
+    last = &buffer->entry[ENTRY_INDEX(buffer, number + count - 1)];
+    return (loff_t)(last->start + last->size - buffer->base);
 }
-#endif
 /*
 * Function	: get_populated_nodes()
 * Purpose	: obtain how much locations has data written there.
@@ -45,15 +64,10 @@ loff_t aesd_circular_buffer_llseek(struct aesd_circular_buffer *buffer, unsigned
 * returns	: The current location based on the buffer data	
 */
 int get_populated_nodes(struct aesd_circular_buffer *buffer){
-int remaining = buffer->out_offs - buffer->in_offs;
 if(buffer->full)
 	return MAX_WRITE;
-else if(buffer->in_offs < buffer->out_offs)
-	return remaining;
-else if(buffer->out_offs < buffer->in_offs)
-	return MAX_WRITE - (remaining) + 1;
-else
-	return 0;
+// Entries run from out_offs up to in_offs, wrapping around the end of the array
+return (buffer->in_offs - buffer->out_offs + MAX_WRITE) % MAX_WRITE;
 }
 /*
 * Function	: get_the_total_buffer_size()
@@ -62,15 +76,8 @@ else
 * returns	: total size of the buffer	
 */
 size_t get_the_total_buffer_size(struct aesd_circular_buffer *buffer){
-	size_t total_size = 0;
-	int nodes = get_populated_nodes(buffer);
-	uint8_t index = buffer->out_offs;
-	while(nodes > 0){
-		total_size += buffer->entry[index].size;
-		index = (index + 1) % MAX_WRITE;
-		nodes--;
-	}
-	return total_size;
+	// head and base move with every add and eviction, nothing to sum up
+	return (size_t)(buffer->head - buffer->base);
 }
 /**
  * @param buffer the buffer to search for corresponding offset.  Any necessary locking must be performed by caller.
@@ -86,27 +93,29 @@ struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct
             size_t char_offset, size_t *entry_offset_byte_rtn )
 {
 // The function has to return the position described by char_offset
-struct aesd_buffer_entry *position = NULL;
-int current_location = get_populated_nodes(buffer);
-uint8_t index;
+struct aesd_buffer_entry *position;
+uint64_t target;
+uint32_t low, high, middle;
 // Check if your list actually exists and if you are trying to encode a value in an unexisting location
 if(!buffer || !entry_offset_byte_rtn)
 	return NULL;
-index = buffer->out_offs;
-// start looping through those nodes to see if offset matches
-while(current_location){
-	if(char_offset <= buffer->entry[index].size - 1){
-		*entry_offset_byte_rtn = char_offset;
-		position = &buffer->entry[index];
-		break;
-	}
-	else{
-		char_offset -= buffer->entry[index].size;
-		index = (index+1) % MAX_WRITE;
-		current_location--;
-	}
-}
 // if data is not written or position is not available this will return NULL
+if(char_offset >= buffer->head - buffer->base)
+	return NULL;
+target = buffer->base + char_offset;
+// The starts grow from the oldest entry on, binary search for the last entry starting at or before target.
+// An empty entry shares its start with the next one and is never the last.
+low = 0;
+high = get_populated_nodes(buffer) - 1;
+while(low < high){
+	middle = low + (high - low + 1) / 2;
+	if(buffer->entry[ENTRY_INDEX(buffer, middle)].start <= target)
+		low = middle;
+	else
+		high = middle - 1;
+}
+position = &buffer->entry[ENTRY_INDEX(buffer, low)];
+*entry_offset_byte_rtn = (size_t)(target - position->start);
 return position;
 }
 
@@ -116,31 +125,82 @@ return position;
 * new start location.
 * Any necessary locking must be handled by the caller
 * Any memory referenced in @param add_entry must be allocated by and/or must have a lifetime managed by the caller.
+* @return the buffptr of the overwritten entry for the caller to free, NULL when nothing was overwritten
 */
-void aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry)
+const char *aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry)
 {
-static uint8_t entries = 0;
+const char *evicted = NULL;
 // Check if your list actually exists or if you are trying to encode an unexisting value
 if(!buffer || (!add_entry))
-	return;
-if(buffer->full)
+	return NULL;
+if(buffer->full){
+	evicted = buffer->entry[buffer->in_offs].buffptr;
+	buffer->base += buffer->entry[buffer->in_offs].size;
 	buffer->out_offs = (buffer->out_offs + 1) % MAX_WRITE;
+}
 // Perform circular buffer write operation and Increment the writing pointer and wrap around the circular buffer
 buffer->entry[buffer->in_offs] = *add_entry;
+buffer->entry[buffer->in_offs].start = buffer->head;
+buffer->head += add_entry->size;
 buffer->in_offs = (buffer->in_offs+1) % MAX_WRITE;
-entries++;
-//Check full case conditions
-if(entries == MAX_WRITE)
+//Check full case conditions, the write pointer caught up with the read pointer
+if(buffer->in_offs == buffer->out_offs)
 	buffer->full = true;
 //if buffer is full - expectation is to overwrite the most oldest elements, meaning, where the buffer->out_offs pointer is currently residing.
 //Increment the read pointer and wrap around the circular buffer
-return;
+return evicted;
 }
 
 /**
-* Initializes the circular buffer described by @param buffer to an empty struct
+* Initializes the circular buffer described by @param buffer to an empty struct, keeping
+* AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED entries in its own storage
 */
 void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer)
 {
     memset(buffer,0,sizeof(struct aesd_circular_buffer));
+    buffer->entry = buffer->storage;
+    buffer->capacity = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+}
+
+/**
+* Initializes the circular buffer described by @param buffer to an empty struct with a capacity chosen at run time
+* @param entries array of @param capacity entries (at least 1) the buffer keeps its entries in, owned by the caller
+*/
+void aesd_circular_buffer_init_capacity(struct aesd_circular_buffer *buffer, struct aesd_buffer_entry *entries,
+            uint32_t capacity)
+{
+    memset(buffer,0,sizeof(struct aesd_circular_buffer));
+    memset(entries,0,sizeof(struct aesd_buffer_entry) * capacity);
+    buffer->entry = entries;
+    buffer->capacity = capacity;
+}
+
+/**
+* Moves the entries of @param buffer into @param entries, an array of @param capacity entries (at least 1), oldest
+* entry first. When the new capacity is smaller than the number of entries the oldest ones are dropped, the caller
+* frees their buffptr beforehand (they are the first get_populated_nodes() - capacity entries from out_offs).
+* Any necessary locking must be handled by the caller
+* @return the previous entry array for the caller to free, NULL when it was the storage of the buffer
+*/
+struct aesd_buffer_entry *aesd_circular_buffer_resize(struct aesd_circular_buffer *buffer, struct aesd_buffer_entry *entries,
+            uint32_t capacity)
+{
+struct aesd_buffer_entry *previous = buffer->entry;
+uint32_t populated = get_populated_nodes(buffer);
+uint32_t kept = (populated > capacity) ? capacity : populated;
+uint32_t index = (buffer->out_offs + populated - kept) % MAX_WRITE;
+uint32_t i;
+memset(entries,0,sizeof(struct aesd_buffer_entry) * capacity);
+for(i = 0; i < kept; i++){
+	entries[i] = buffer->entry[index];
+	index = (index + 1) % MAX_WRITE;
+}
+buffer->entry = entries;
+buffer->capacity = capacity;
+buffer->out_offs = 0;
+buffer->in_offs = kept % capacity;
+buffer->full = (kept == capacity);
+// The dropped entries leave the front, the kept ones keep their start
+buffer->base = kept ? entries[0].start : buffer->head;
+return (previous == buffer->storage) ? NULL : previous;
 }
@@ -11,12 +11,18 @@
 #ifdef __KERNEL__
 #include <linux/types.h>
 #else
+#include <sys/types.h> // loff_t
 #include <stddef.h> // size_t
 #include <stdint.h> // uintx_t
 #include <stdbool.h>
 #endif
 
+// Capacity in entries when none is given, the module parameter and the memory backend default to it
 #define AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED 10
+// Bytes the entry array may take at most
+#define AESDCHAR_MAX_ENTRY_ARRAY_SIZE (32U << 20)
+// Largest capacity accepted, as many entries as fit into AESDCHAR_MAX_ENTRY_ARRAY_SIZE
+#define AESDCHAR_MAX_CAPACITY ((uint32_t)(AESDCHAR_MAX_ENTRY_ARRAY_SIZE / sizeof(struct aesd_buffer_entry)))
 
 struct aesd_buffer_entry
 {
@@ -28,49 +34,78 @@ struct aesd_buffer_entry
      * Number of bytes stored in buffptr
      */
     size_t size;
+    /**
+     * Position of buffptr[0] counted over every byte the circular buffer ever took, set when the entry is added
+     */
+    uint64_t start;
 };
 
 struct aesd_circular_buffer
 {
     /**
-     * An array of pointers to memory allocated for the most recent write operations
+     * An array of capacity entries for the most recent write operations, storage or an array allocated by the
+     * owner of the buffer
+     */
+    struct aesd_buffer_entry *entry;
+    /**
+     * Number of entries in the entry array
      */
-    struct aesd_buffer_entry  entry[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    uint32_t capacity;
     /**
      * The current location in the entry structure where the next write should
      * be stored.
      */
-    uint8_t in_offs;
+    uint32_t in_offs;
     /**
      * The first location in the entry structure to read from
      */
-    uint8_t out_offs;
+    uint32_t out_offs;
     /**
      * set to true when the buffer entry structure is full
      */
     bool full;
+    /**
+     * Position just behind the newest entry, counted like aesd_buffer_entry.start
+     */
+    uint64_t head;
+    /**
+     * Position of the oldest entry counted the same way, head - base is the number of bytes in the buffer
+     */
+    uint64_t base;
+    /**
+     * The entries of a buffer set up by aesd_circular_buffer_init(), with the default capacity
+     */
+    struct aesd_buffer_entry storage[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
 };
 
-#ifdef __KERNEL__
-loff_t aesd_circular_buffer_llseek(struct aesd_circular_buffer *buffer, unsigned int number, unsigned int offset);
-#endif
+extern loff_t aesd_circular_buffer_llseek(struct aesd_circular_buffer *buffer, unsigned int number, unsigned int offset);
+
+extern loff_t aesd_circular_buffer_entries_end(struct aesd_circular_buffer *buffer, unsigned int number, unsigned int count);
+
+extern int get_populated_nodes(struct aesd_circular_buffer *buffer);
 
 extern size_t get_the_total_buffer_size(struct aesd_circular_buffer *buffer);
 
 extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
             size_t char_offset, size_t *entry_offset_byte_rtn );
-extern void aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry);
+extern const char *aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry);
 
 extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
 
+extern void aesd_circular_buffer_init_capacity(struct aesd_circular_buffer *buffer, struct aesd_buffer_entry *entries,
+            uint32_t capacity);
+
+extern struct aesd_buffer_entry *aesd_circular_buffer_resize(struct aesd_circular_buffer *buffer, struct aesd_buffer_entry *entries,
+            uint32_t capacity);
+
 /**
  * Create a for loop to iterate over each member of the circular buffer.
  * Useful when you've allocated memory for circular buffer entries and need to free it
  * @param entryptr is a struct aesd_buffer_entry* to set with the current entry
  * @param buffer is the struct aesd_buffer * describing the buffer
- * @param index is a uint8_t stack allocated value used by this macro for an index
+ * @param index is a uint32_t stack allocated value used by this macro for an index
  * Example usage:
- * uint8_t index;
+ * uint32_t index;
  * struct aesd_circular_buffer buffer;
  * struct aesd_buffer_entry *entry;
  * AESD_CIRCULAR_BUFFER_FOREACH(entry,&buffer,index) {
@@ -79,7 +114,7 @@ extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
  */
 #define AESD_CIRCULAR_BUFFER_FOREACH(entryptr,buffer,index) \
     for(index=0, entryptr=&((buffer)->entry[index]); \
-            index<AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; \
+            index<(buffer)->capacity; \
             index++, entryptr=&((buffer)->entry[index]))
 
 
@@ -24,7 +24,8 @@
  */
 struct aesd_seekto {
     /**
-     * The zero referenced write command to seek into
+     * The zero referenced write command to seek into. A write command is one write() call, or one segment of a
+     * writev(), up to its last newline.
      */
     uint32_t write_cmd;
     /**
@@ -33,15 +34,58 @@ struct aesd_seekto {
     uint32_t write_cmd_offset;
 };
 
+/**
+ * A structure passed by AESDCHAR_IOCRANGE, a seek which also bounds the read that follows it
+ */
+struct aesd_range {
+    /**
+     * The zero referenced write command to start at
+     */
+    uint32_t write_cmd;
+    /**
+     * The zero referenced offset within that write
+     */
+    uint32_t write_cmd_offset;
+    /**
+     * Number of writes in the range, at least 1, cut short at the newest write
+     */
+    uint32_t write_cmd_count;
+    uint32_t reserved;
+    /**
+     * Set by the driver: the file position just behind the range. Reads stop there only if user space stops
+     * there, the file position is moved to the start of the range like AESDCHAR_IOCSEEKTO does.
+     */
+    uint64_t end;
+};
+
+/**
+ * A structure passed by AESDCHAR_IOCCAPACITY, changes how many writes the device keeps
+ */
+struct aesd_capacity {
+    /**
+     * New number of writes kept, between 1 and AESDCHAR_MAX_CAPACITY, or 0 to leave it unchanged. Shrinking drops
+     * the oldest writes. Set by the driver to the capacity in effect.
+     */
+    uint32_t capacity;
+    /**
+     * Set by the driver: the number of writes currently kept
+     */
+    uint32_t entries;
+};
+
 // Pick an arbitrary unused value from https://github.com/torvalds/linux/blob/master/Documentation/userspace-api/ioctl/ioctl-number.rst
 #define AESD_IOC_MAGIC 0x16
 
 // Define a write command from the user point of view, use command number 1
 //_IOWR() The call writes data to the kernel and wants information back.
 #define AESDCHAR_IOCSEEKTO _IOWR(AESD_IOC_MAGIC, 1, struct aesd_seekto)
+// Seek like AESDCHAR_IOCSEEKTO and report where a range of writes ends, command number 2
+#define AESDCHAR_IOCRANGE _IOWR(AESD_IOC_MAGIC, 2, struct aesd_range)
+// Change or query the number of writes kept, command number 3
+#define AESDCHAR_IOCCAPACITY _IOWR(AESD_IOC_MAGIC, 3, struct aesd_capacity)
 /**
  * The maximum number of commands supported, used for bounds checking
  */
-#define AESDCHAR_IOC_MAXNR 1
+#define AESDCHAR_IOC_MAXNR 3
 
 #endif /* AESD_IOCTL_H */
@@ -32,7 +32,7 @@ struct aesd_dev
     struct cdev cdev;     /* Char device structure      */
     struct aesd_buffer_entry entry;
     struct aesd_circular_buffer buffer;
-    struct mutex lock;
+    struct rw_semaphore lock; /* read() and the seeks share it, write() and AESDCHAR_IOCCAPACITY own it */
 };
 
 
@@ -19,6 +19,11 @@
 #include <linux/fs.h> // file_operations used for alloc_chrdev_region and unregister_chrdev_region
 #include <linux/uaccess.h> //for copy to user and copy from user
 #include <linux/slab.h>
+#include <linux/mm.h> //kvmalloc_array for entry arrays larger than a page
+#include <linux/moduleparam.h>
+#include <linux/rwsem.h> //readers share the device, writers own it
+#include <linux/uio.h> //iov_iter for read_iter and write_iter
+#include <linux/string.h>
 #include <linux/kdev_t.h>
 #include "aesdchar.h"
 #include "aesd-circular-buffer.h"
@@ -30,6 +35,10 @@ MODULE_AUTHOR("srki3050"); /** TODO: fill in your name **/
 MODULE_LICENSE("Dual BSD/GPL");
 
 struct aesd_dev aesd_device;
+// Writes the device keeps when loaded, insmod aesdchar.ko capacity=N. AESDCHAR_IOCCAPACITY changes it at run time.
+static uint aesd_capacity = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+module_param_named(capacity, aesd_capacity, uint, 0444);
+MODULE_PARM_DESC(capacity, "number of writes kept by the device (at least 1, at most 32 MiB of entries)");
 //Source Linux Device Drivers chapter 3
 //opens a new file object and linking it to the corresponding object
 //inode contains general information about a file.
@@ -41,6 +50,8 @@ int aesd_open(struct inode *inode, struct file *filp)
     struct aesd_dev *dev;
     dev=container_of(inode->i_cdev, struct aesd_dev, cdev);
     filp->private_data=dev;
+    // The iter functions honour IOCB_NOWAIT, io_uring may issue inline instead of punting to a worker
+    filp->f_mode |= FMODE_NOWAIT;
     PDEBUG("open");
     return 0;
 }
@@ -50,84 +61,210 @@ int aesd_release(struct inode *inode, struct file *filp)
     PDEBUG("release");
     return 0;
 }
-//Function:	aesd_read
-//Purpose:	read from the hardware and submit data back to the user.
-//@parameters:	filep 	- file pointer,
-//		count 	- size of data transfer,
-//		buf 	- empty buffer where newly read data has to be placed
-//		f_pos 	- long offset type indicating the file position that user is accessing
-//@returns:	signed size type
-ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
-                loff_t *f_pos)
+//Function:	aesd_read_iter
+//Purpose:	read from the hardware and submit data back to the user, for read(), readv(), preadv2() and io_uring.
+//		The read continues across entries until the iov_iter is full or the newest entry is copied.
+//@parameters:	iocb	- the file and the position the user is accessing (ki_pos), IOCB_NOWAIT for io_uring
+//		to	- the user buffers where newly read data has to be placed
+//@returns:	signed size type, -EFAULT when nothing could be copied, -EAGAIN when IOCB_NOWAIT would have to wait
+ssize_t aesd_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
-	ssize_t buffer_entry_offset = 0;
-	ssize_t bytes_to_user = 0;
-	ssize_t read_bytes = 0;
-	int lock_status;
+	size_t buffer_entry_offset = 0;
+	size_t read_bytes = 0;
+	size_t chunk, copied;
 	struct aesd_buffer_entry * pos = NULL;
-	struct aesd_dev *dev = (struct aesd_dev *)filp->private_data;
-	PDEBUG("read %zu bytes with offset %lld",count,*f_pos);
-	lock_status = mutex_lock_interruptible(&aesd_device.lock);
-	if (lock_status)
+	struct aesd_dev *dev = (struct aesd_dev *)iocb->ki_filp->private_data;
+	PDEBUG("read %zu bytes with offset %lld",iov_iter_count(to),iocb->ki_pos);
+	// Readers only share the lock, any number of them copy out at the same time
+	if (iocb->ki_flags & IOCB_NOWAIT) {
+		if (!down_read_trylock(&dev->lock))
+			return -EAGAIN;
+	}
+	else if (down_read_interruptible(&dev->lock)) {
 		return -ERESTARTSYS;
-	pos = aesd_circular_buffer_find_entry_offset_for_fpos(&dev->buffer, *f_pos, &buffer_entry_offset);
-	if(!pos) {
-		mutex_unlock(&aesd_device.lock);
-		return 0;
 	}
-	read_bytes = pos->size - buffer_entry_offset;
-    	read_bytes = read_bytes > count?count:read_bytes;
-	bytes_to_user = copy_to_user(buf, pos->buffptr + buffer_entry_offset, read_bytes);
-	if (bytes_to_user) {
-		mutex_unlock(&aesd_device.lock);
-		return 0;
+	while (iov_iter_count(to)) {
+		pos = aesd_circular_buffer_find_entry_offset_for_fpos(&dev->buffer, iocb->ki_pos + read_bytes, &buffer_entry_offset);
+		if(!pos)
+			break;
+		chunk = pos->size - buffer_entry_offset;
+		chunk = chunk > iov_iter_count(to) ? iov_iter_count(to) : chunk;
+		copied = copy_to_iter(pos->buffptr + buffer_entry_offset, chunk, to);
+		read_bytes += copied;
+		// A fault part way through still returns the bytes copied before it
+		if (copied != chunk) {
+			if (!read_bytes) {
+				up_read(&dev->lock);
+				return -EFAULT;
+			}
+			break;
+		}
 	}
-	*f_pos = *f_pos + read_bytes;
-	mutex_unlock(&aesd_device.lock);
+	iocb->ki_pos += read_bytes;
+	up_read(&dev->lock);
 	return read_bytes;
 }
-//Function:	aesd_write
-//Purpose:	Accept data from the user space and write the data to the hardware
-//@parameters:	filp	- file pointer
-//		buf	- value to write in kernel
-//		count	- how many bytes you are trying to count
-//		f_pos 	- long offset type indicating the file position that user is accessing
-//@returns:	signed size type
-ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
-                loff_t *f_pos)
+//Function:	aesd_write_iter
+//Purpose:	Accept data from the user space and write the data to the hardware, for write(), writev(), pwritev2()
+//		and io_uring. Every write() call, and every segment of a writev(), adds one entry ending at its last
+//		newline, as when each segment was a write() of its own. The bytes behind the last newline wait in
+//		dev->entry for the next write. All segments are copied in first and then committed under one lock, so
+//		the entries of one writev() never interleave with another writer's.
+//@parameters:	iocb	- the file, IOCB_NOWAIT for io_uring
+//		from	- the user buffers holding the data
+//@returns:	signed size type, -EFAULT, -ENOMEM, or -EAGAIN when IOCB_NOWAIT would have to wait. When memory runs
+//		out part way, the bytes of the segments committed before are returned.
+ssize_t aesd_write_iter(struct kiocb *iocb, struct iov_iter *from)
 {
-	int interuptible_lock, total_bytes_copied;
-	int i;
-	struct aesd_dev *dev = (struct aesd_dev *)filp->private_data;
-	PDEBUG("write %zu bytes with offset %lld",count,*f_pos);
-    	interuptible_lock = mutex_lock_interruptible(&aesd_device.lock);
-    	if(interuptible_lock){
-    		return -ERESTARTSYS;
-    	}
-    	/********************************************Accessing data and perform write function****************************************/
-    	//if there are no elements in the circular buffer
-    	if(!dev->entry.size) {
-    		//allocate the necessary amount of memory in the kernel for the required bytes you are writing
-    		dev->entry.buffptr = kmalloc((sizeof(char)*count),GFP_KERNEL);
-    	}	
-    	else{
-    		dev->entry.buffptr = krealloc(dev->entry.buffptr, (dev->entry.size + count)*sizeof(char), GFP_KERNEL);
-    	}
-    	total_bytes_copied = copy_from_user((void *)(&dev->entry.buffptr[dev->entry.size]), buf, count);
-    	dev->entry.size += count;
-    	for (i=0; i<dev->entry.size; i++)
-    	{
-    		if(dev->entry.buffptr[i] == '\n')
-    		{
-    			aesd_circular_buffer_add_entry(&dev->buffer, &dev->entry);
-    			dev->entry.buffptr = NULL;
-    			dev->entry.size = 0;
-    		}
-    	}
-    	/******************************************Write complete, release the resources**********************************************/
-    	mutex_unlock(&aesd_device.lock);
-    	*f_pos = 0;
-    	return count;
+	size_t count = iov_iter_count(from);
+	size_t left, segment, start, end, piece, done = 0;
+	unsigned long segments, n;
+	size_t *ends;
+	char *kbuf, *entry, *tail;
+	struct aesd_dev *dev = (struct aesd_dev *)iocb->ki_filp->private_data;
+	gfp_t gfp = (iocb->ki_flags & IOCB_NOWAIT) ? (GFP_NOWAIT | __GFP_NOWARN) : GFP_KERNEL;
+	ssize_t retval;
+	PDEBUG("write %zu bytes with offset %lld",count,iocb->ki_pos);
+	if (!count)
+		return 0;
+	// At most one boundary per iovec, a single user buffer (ITER_UBUF) and kernel or page vectors are one write
+	segments = iter_is_iovec(from) ? from->nr_segs : 1;
+	// Copying in before taking the lock keeps page faults away from the readers
+	kbuf = kmalloc(count, gfp);
+	ends = kmalloc_array(segments, sizeof(size_t), gfp);
+	if (!kbuf || !ends) {
+		retval = (iocb->ki_flags & IOCB_NOWAIT) ? -EAGAIN : -ENOMEM;
+		goto out;
+	}
+	for (n = 0, end = 0; (left = iov_iter_count(from)) != 0; ) {
+		// The rest of the current user buffer, iter_iov() covers iovec arrays and ITER_UBUF alike
+		segment = user_backed_iter(from) ? min(left, iter_iov_len(from)) : left;
+		if (!segment) {
+			// A zero length iovec is no write of its own, advancing by nothing steps over it
+			iov_iter_advance(from, 0);
+			continue;
+		}
+		if (!copy_from_iter_full(kbuf + end, segment, from)) {
+			retval = -EFAULT;
+			goto out;
+		}
+		end += segment;
+		ends[n++] = end;
+	}
+	segments = n;
+	if (iocb->ki_flags & IOCB_NOWAIT) {
+		if (!down_write_trylock(&dev->lock)) {
+			retval = -EAGAIN;
+			goto out;
+		}
+	}
+	// There is no interruptible writer side of a rw_semaphore, a fatal signal still gets the writer out
+	else if (down_write_killable(&dev->lock)) {
+		retval = -ERESTARTSYS;
+		goto out;
+	}
+	for (n = 0, start = 0; n < segments; start = ends[n++]) {
+		// Up to and including the last newline of the segment completes the entry, the rest stays pending
+		for (end = ends[n]; (end > start) && (kbuf[end - 1] != '\n'); end--);
+		piece = ((end > start) ? end : ends[n]) - start;
+		tail = NULL;
+		if (!dev->entry.size && (segments == 1) && (piece == count)) {
+			// The whole write is one entry and nothing is pending, the copy becomes the entry itself
+			entry = kbuf;
+			kbuf = NULL;
+		}
+		else {
+			// Everything the segment needs is allocated before any of it is committed. Growing the pending
+			// entry keeps its bytes, so a failure leaves the device as the previous segment left it.
+			entry = krealloc(dev->entry.buffptr, dev->entry.size + piece, gfp);
+			if (!entry)
+				goto unlock;
+			dev->entry.buffptr = entry;
+			if ((end > start) && (ends[n] > end)) {
+				tail = kmalloc(ends[n] - end, gfp);
+				if (!tail)
+					goto unlock;
+			}
+			memcpy(entry + dev->entry.size, kbuf + start, piece);
+		}
+		dev->entry.buffptr = entry;
+		dev->entry.size += piece;
+		if (end > start) {
+			// The oldest write falls out of a full buffer
+			kfree(aesd_circular_buffer_add_entry(&dev->buffer, &dev->entry));
+			// The bytes behind the last newline start the next pending entry
+			dev->entry.buffptr = tail;
+			dev->entry.size = ends[n] - end;
+			if (tail)
+				memcpy(tail, kbuf + end, dev->entry.size);
+		}
+		done = ends[n];
+	}
+unlock:
+	up_write(&dev->lock);
+	// The segments committed before an allocation failed stay, the rest of the write is reported as not done
+	if (!done) {
+		retval = (iocb->ki_flags & IOCB_NOWAIT) ? -EAGAIN : -ENOMEM;
+		goto out;
+	}
+	// A write leaves the file position at the start, as write() always did
+	iocb->ki_pos = 0;
+	retval = done;
+out:
+	kfree(ends);
+	kfree(kbuf);
+	return retval;
+}
+/* Function	: aesd_ioctl_capacity
+ * Purpose	: AESDCHAR_IOCCAPACITY, move the writes kept into a new entry array of the requested capacity
+ * Parameters	: the device and the user space struct aesd_capacity
+ * Returns	: 0 on success, -EINVAL for a capacity out of range, -ENOMEM, -EFAULT or -ERESTARTSYS
+ */
+static long aesd_ioctl_capacity(struct aesd_dev *dev, unsigned long arg)
+{
+    struct aesd_capacity capacity;
+    struct aesd_buffer_entry *entries = NULL;
+    struct aesd_buffer_entry *previous = NULL;
+    uint32_t populated, index;
+    if (copy_from_user(&capacity, (void *)arg, sizeof(capacity)))
+        return -EFAULT;
+    if (capacity.capacity > AESDCHAR_MAX_CAPACITY)
+        return -EINVAL;
+    if (!capacity.capacity) {
+        // A query only reads, it shares the lock with the readers
+        if (down_read_interruptible(&dev->lock))
+            return -ERESTARTSYS;
+        capacity.capacity = dev->buffer.capacity;
+        capacity.entries = get_populated_nodes(&dev->buffer);
+        up_read(&dev->lock);
+    }
+    else {
+        // The new array is allocated before the lock is taken, readers and writers only wait for the move
+        entries = kvmalloc_array(capacity.capacity, sizeof(struct aesd_buffer_entry), GFP_KERNEL);
+        if (!entries)
+            return -ENOMEM;
+        if (down_write_killable(&dev->lock)) {
+            kvfree(entries);
+            return -ERESTARTSYS;
+        }
+        // The oldest writes which do not fit anymore are dropped
+        populated = get_populated_nodes(&dev->buffer);
+        index = dev->buffer.out_offs;
+        while (populated > capacity.capacity) {
+            kfree(dev->buffer.entry[index].buffptr);
+            index = (index + 1) % dev->buffer.capacity;
+            populated--;
+        }
+        previous = aesd_circular_buffer_resize(&dev->buffer, entries, capacity.capacity);
+        aesd_capacity = capacity.capacity;
+        capacity.capacity = dev->buffer.capacity;
+        capacity.entries = get_populated_nodes(&dev->buffer);
+        up_write(&dev->lock);
+        kvfree(previous);
+    }
+    if (copy_to_user((void *)arg, &capacity, sizeof(capacity)))
+        return -EFAULT;
+    return 0;
 }
 /* Function	: aesd_ioctl
  * Purpose	: Perform the IOCTL command if the argument by calling writes data to the kernel and expecting information back.
@@ -139,37 +276,54 @@ long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
     size_t bytes_copied_From_user = 0;
     int lock_status;
-    loff_t pos;
+    loff_t pos, end;
     struct aesd_dev *dev = NULL;
     struct aesd_seekto seekto;
+    struct aesd_range range;
     dev = filp->private_data;
-    lock_status = mutex_lock_interruptible(&dev->lock);
-    if(lock_status){
-    	mutex_unlock(&dev->lock);
-    	return -ERESTARTSYS;
-    }
     if(!dev){
-    	mutex_unlock(&dev->lock);
     	return -ENOMEM;
-    }	
-    else if ((_IOC_TYPE(cmd) != AESD_IOC_MAGIC) || (_IOC_NR(cmd) > AESDCHAR_IOC_MAXNR) || (cmd != AESDCHAR_IOCSEEKTO)){
-    	mutex_unlock(&dev->lock);
+    }
+    if ((_IOC_TYPE(cmd) != AESD_IOC_MAGIC) || (_IOC_NR(cmd) > AESDCHAR_IOC_MAXNR) ||
+        ((cmd != AESDCHAR_IOCSEEKTO) && (cmd != AESDCHAR_IOCRANGE) && (cmd != AESDCHAR_IOCCAPACITY))){
         return -ENOTTY;
     }
+    if (cmd == AESDCHAR_IOCCAPACITY) {
+        return aesd_ioctl_capacity(dev, arg);
+    }
+    // Copy the argument in before taking the lock, a fault must not leave the device locked
     if (cmd == AESDCHAR_IOCSEEKTO) {
         bytes_copied_From_user = copy_from_user(&seekto, (void *)arg, sizeof(seekto));
-        if (bytes_copied_From_user)
-            return -EFAULT;
-        
-        pos = aesd_circular_buffer_llseek(&dev->buffer, seekto.write_cmd, seekto.write_cmd_offset);
-	if (pos == -EINVAL) {
-		mutex_unlock(&dev->lock);
-        	return -EINVAL;
-    	} 
-    	else {
-        	filp->f_pos = pos;
-        	mutex_unlock(&dev->lock);
-    	}
+    }
+    else {
+        bytes_copied_From_user = copy_from_user(&range, (void *)arg, sizeof(range));
+        seekto.write_cmd = range.write_cmd;
+        seekto.write_cmd_offset = range.write_cmd_offset;
+    }
+    if (bytes_copied_From_user)
+        return -EFAULT;
+    lock_status = down_read_interruptible(&dev->lock);
+    if(lock_status){
+    	return -ERESTARTSYS;
+    }
+    pos = aesd_circular_buffer_llseek(&dev->buffer, seekto.write_cmd, seekto.write_cmd_offset);
+    if (pos == -EINVAL) {
+	up_read(&dev->lock);
+        return -EINVAL;
+    }
+    if (cmd == AESDCHAR_IOCRANGE) {
+        // The start and the end are taken under one lock, a write in between can not shift the range
+        end = aesd_circular_buffer_entries_end(&dev->buffer, range.write_cmd, range.write_cmd_count);
+        if (end == -EINVAL) {
+            up_read(&dev->lock);
+            return -EINVAL;
+        }
+        range.end = end;
+    }
+    filp->f_pos = pos;
+    up_read(&dev->lock);
+    if ((cmd == AESDCHAR_IOCRANGE) && copy_to_user((void *)arg, &range, sizeof(range))) {
+        return -EFAULT;
     }
     return 0;
 }
@@ -189,20 +343,20 @@ loff_t aesd_llseek(struct file *filp, loff_t offset, int whence)
     if (!dev) {
         return -ENOMEM;
     }
-    lock_status = mutex_lock_interruptible(&dev->lock);
+    lock_status = down_read_interruptible(&dev->lock);
     if (lock_status) {
         return -EINTR;
     }
     retval = fixed_size_llseek(filp, offset, whence, get_the_total_buffer_size(&dev->buffer));
-    mutex_unlock(&dev->lock);
+    up_read(&dev->lock);
     return retval;
 }
 //THIS_MODULE - used to prevent the module from being unloaded while the structure is still in use
 //Macro to the module variable that points to the current module.
 struct file_operations aesd_fops = {
     .owner =    THIS_MODULE,
-    .read =     aesd_read,
-    .write =    aesd_write,
+    .read_iter =    aesd_read_iter,
+    .write_iter =   aesd_write_iter,
     .open =     aesd_open,
     .release =  aesd_release,
     .llseek =   aesd_llseek,
@@ -232,6 +386,7 @@ int aesd_init_module(void)
     //out of 32bits, 12 bits for major number and 20 bits for minor number
     dev_t dev = 0;
     int result;
+    struct aesd_buffer_entry *entries;
     //register your device into the linux kernel - do this to register during module initialize to the kernel.
     //Major number is dynamically allocated by the kernel
     //aesdchar is the name we give to identify the device number range
@@ -243,11 +398,23 @@ int aesd_init_module(void)
         return result;
     }
     memset(&aesd_device,0,sizeof(struct aesd_dev));
+    if ((aesd_capacity < 1) || (aesd_capacity > AESDCHAR_MAX_CAPACITY)) {
+        printk(KERN_WARNING "aesdchar: capacity must be between 1 and %u\n", AESDCHAR_MAX_CAPACITY);
+        unregister_chrdev_region(dev, 1);
+        return -EINVAL;
+    }
+    entries = kvmalloc_array(aesd_capacity, sizeof(struct aesd_buffer_entry), GFP_KERNEL);
+    if (!entries) {
+        unregister_chrdev_region(dev, 1);
+        return -ENOMEM;
+    }
+    aesd_circular_buffer_init_capacity(&aesd_device.buffer, entries, aesd_capacity);
 
-    mutex_init(&aesd_device.lock);
+    init_rwsem(&aesd_device.lock);
     result = aesd_setup_cdev(&aesd_device);
 
     if( result ) {
+        kvfree(entries);
         unregister_chrdev_region(dev, 1);
     }
     PDEBUG("\r\nMODULE LOADED SUCCESSFULLY");
@@ -257,7 +424,7 @@ int aesd_init_module(void)
 
 void aesd_cleanup_module(void)
 {
-    uint8_t index = 0;
+    uint32_t index = 0;
     struct aesd_buffer_entry *entry = NULL;
     //Create a dev_t
     dev_t devno = MKDEV(aesd_major, aesd_minor);
@@ -269,7 +436,9 @@ void aesd_cleanup_module(void)
   		kfree(entry->buffptr);
   	}
     }
-    mutex_destroy(&aesd_device.lock);
+    // A write still waiting for its newline
+    kfree(aesd_device.entry.buffptr);
+    kvfree(aesd_device.buffer.entry);
     unregister_chrdev_region(devno, 1);
 }
 
@@ -0,0 +1,119 @@
+/* Name	:	Sricharan Kidambi S
+   File	:	aesd-arena.c
+   Brief	:	Arena allocator and arena pool of aesdsocket, see aesd-arena.h
+   Notes	:	1.	An arena is one malloc() of AESD_ARENA_SIZE bytes. Allocations only move arena->used forward, they
+   				are released together when the arena is reset on its way back to the pool.
+   			2.	The pool is a list under a mutex which is taken once per connection, on accept and on close.
+   			3.	Arenas are not cleared when recycled. Pages touched by a previous connection stay mapped, which is
+   				what makes recycling cheaper than a fresh malloc() of the same size.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "aesd-arena.h"
+#include "aesd-metrics.h"
+
+#define ARENA_ALIGN 16
+#define ARENA_CAPACITY (AESD_ARENA_SIZE - sizeof(aesd_arena_t))
+
+static pthread_mutex_t arena_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static aesd_arena_t *arena_pool;
+static int arena_pool_idle;
+
+// Take an arena, see aesd-arena.h
+aesd_arena_t *aesd_arena_get(void)
+{
+	pthread_mutex_lock(&arena_pool_lock);
+	aesd_arena_t *arena = arena_pool;
+	if(arena){
+		arena_pool = arena->next;
+		arena_pool_idle--;
+	}
+	pthread_mutex_unlock(&arena_pool_lock);
+	if(arena){
+		aesd_metrics_add(AESD_METRIC_ARENAS_RECYCLED, 1);
+	}
+	else{
+		arena = (aesd_arena_t *) malloc(AESD_ARENA_SIZE);
+		if(!arena){
+			return NULL;
+		}
+		aesd_metrics_add(AESD_METRIC_ARENAS_CREATED, 1);
+	}
+	arena->next = NULL;
+	arena->used = 0;
+	arena->last = 0;
+	return arena;
+}
+
+// Give an arena back, see aesd-arena.h
+void aesd_arena_put(aesd_arena_t *arena)
+{
+	if(!arena){
+		return;
+	}
+	aesd_metrics_add(AESD_METRIC_ARENAS_RETURNED, 1);
+	pthread_mutex_lock(&arena_pool_lock);
+	if(arena_pool_idle < AESD_ARENA_POOL_MAX){
+		arena->next = arena_pool;
+		arena_pool = arena;
+		arena_pool_idle++;
+		arena = NULL;
+	}
+	pthread_mutex_unlock(&arena_pool_lock);
+	if(arena){
+		aesd_metrics_add(AESD_METRIC_ARENAS_FREED, 1);
+		free(arena);
+	}
+}
+
+// Bump an allocation, see aesd-arena.h
+void *aesd_arena_alloc(aesd_arena_t *arena, size_t size)
+{
+	size_t start = (arena->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	if((start > ARENA_CAPACITY) || (size > ARENA_CAPACITY - start)){
+		return NULL;
+	}
+	arena->last = start;
+	arena->used = start + size;
+	return arena->memory + start;
+}
+
+// Resize an allocation, see aesd-arena.h
+void *aesd_arena_grow(aesd_arena_t *arena, void *memory, size_t old_size, size_t size)
+{
+	if(memory && ((char *) memory == arena->memory + arena->last)){
+		if(size > ARENA_CAPACITY - arena->last){
+			return NULL;
+		}
+		arena->used = arena->last + size;
+		return memory;
+	}
+	char *grown = (char *) aesd_arena_alloc(arena, size);
+	if(grown && memory){
+		memcpy(grown, memory, (old_size < size) ? old_size : size);
+	}
+	return grown;
+}
+
+// Give memory back, see aesd-arena.h
+void aesd_arena_free(aesd_arena_t *arena, void *memory)
+{
+	if(memory && ((char *) memory == arena->memory + arena->last)){
+		arena->used = arena->last;
+	}
+}
+
+// Whether memory belongs to the arena, see aesd-arena.h
+bool aesd_arena_owns(const aesd_arena_t *arena, const void *memory)
+{
+	return arena && ((uintptr_t) memory >= (uintptr_t) arena->memory) && ((uintptr_t) memory < (uintptr_t) arena->memory + ARENA_CAPACITY);
+}
+
+// Count a fallback to malloc(), see aesd-arena.h
+void aesd_arena_overflow(void)
+{
+	aesd_metrics_add(AESD_METRIC_ARENA_OVERFLOWS, 1);
+}
@@ -0,0 +1,78 @@
+/* Name	:	Sricharan Kidambi S
+   File	:	aesd-arena.h
+   Brief	:	Per connection arenas of aesdsocket. The state of a connection, its receive buffer and its bounce buffer
+   		are bumped out of one arena which goes back to a global pool when the connection closes, so a server in
+   		steady state serves connections without calling malloc() or free().
+*/
+
+#ifndef AESD_ARENA_H
+#define AESD_ARENA_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Room for the connection state, a bounce buffer and a receive buffer of about 32 KB
+#define AESD_ARENA_SIZE (128 * 1024)
+// Idle arenas kept in the pool, arenas returned beyond that are freed
+#define AESD_ARENA_POOL_MAX 64
+
+typedef struct aesd_arena
+{
+	/**
+	 * Next idle arena while the arena is in the pool
+	 */
+	struct aesd_arena *next;
+	/**
+	 * Bytes of memory handed out, everything after that is free
+	 */
+	size_t used;
+	/**
+	 * Offset of the last allocation, which aesd_arena_grow() can extend in place
+	 */
+	size_t last;
+	_Alignas(16) char memory[];
+}aesd_arena_t;
+
+/* Function	: aesd_arena_get
+ * Purpose	: take an empty arena from the pool, a new one is allocated only when the pool is empty
+ * Returns	: the arena, NULL when memory could not be allocated
+ */
+aesd_arena_t *aesd_arena_get(void);
+
+/* Function	: aesd_arena_put
+ * Purpose	: give an arena back to the pool, everything allocated from it is released at once. NULL is ignored.
+ */
+void aesd_arena_put(aesd_arena_t *arena);
+
+/* Function	: aesd_arena_alloc
+ * Purpose	: bump size bytes, aligned to 16, out of an arena. The memory is not cleared.
+ * Returns	: the memory, NULL when the arena has no room left. The caller falls back to malloc() and counts it
+ *		  with aesd_arena_overflow().
+ */
+void *aesd_arena_alloc(aesd_arena_t *arena, size_t size);
+
+/* Function	: aesd_arena_grow
+ * Purpose	: resize memory of an arena to size bytes. The last allocation grows in place, anything else is
+ *		  copied into a new allocation and its old space stays unused until the arena is recycled.
+ * Parameters	: the arena, memory allocated from it and its current size
+ * Returns	: the resized memory, NULL when the arena has no room left (the old memory is still valid then)
+ */
+void *aesd_arena_grow(aesd_arena_t *arena, void *memory, size_t old_size, size_t size);
+
+/* Function	: aesd_arena_free
+ * Purpose	: give back memory of an arena. Only the last allocation is actually reused, freeing anything else
+ *		  does nothing until the arena is recycled.
+ */
+void aesd_arena_free(aesd_arena_t *arena, void *memory);
+
+/* Function	: aesd_arena_owns
+ * Purpose	: whether memory was allocated from the arena, otherwise it came from malloc() and has to be freed
+ */
+bool aesd_arena_owns(const aesd_arena_t *arena, const void *memory);
+
+/* Function	: aesd_arena_overflow
+ * Purpose	: count an allocation which did not fit into its arena and went to malloc() instead
+ */
+void aesd_arena_overflow(void);
+
+#endif /* AESD_ARENA_H */
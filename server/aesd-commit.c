@@ -0,0 +1,153 @@
+/* Name	:	Sricharan Kidambi S
+   File	:	aesd-commit.c
+   Brief	:	Group commit stage of aesdsocket, enabled with -g
+   Notes	:	1.	Connections queue their complete packets, the committer takes the whole queue at once and appends it
+   				with one call of the store backend under mutex_lock, one iovec per packet. On the device and the file
+   				that is a single writev(), so many concurrent writers cost one system call (and one fdatasync() on
+   				the file) instead of one each.
+   			2.	A packet is never split: on a regular file the O_APPEND writev() is applied as a unit, on
+   				/dev/aesdchar the kernel hands every iovec to the driver as its own write() call.
+   			3.	Requests are completed in queue order once the batch is written, the caller may only reuse the
+   				packet memory after its done() callback ran.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/uio.h>
+#include "aesdsocket.h"
+#include "aesd-commit.h"
+#include "aesd-metrics.h"
+#include "aesd-snapshot.h"
+#include "aesd-subscribe.h"
+
+static pthread_mutex_t commit_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t commit_queued = PTHREAD_COND_INITIALIZER;
+static aesd_commit_req_t *queue_head;
+static aesd_commit_req_t *queue_tail;
+static pthread_t committer;
+static aesd_store_t commit_store;
+
+/* Function	: aesd_commit_batch
+ * Purpose	: write one batch of queued packets, in order
+ * Returns	: 0 on success, -1 on failure
+ */
+static int aesd_commit_batch(aesd_commit_req_t *batch)
+{
+	struct iovec iov[AESD_COMMIT_MAX_IOV];
+	struct iovec published[AESD_COMMIT_MAX_IOV];
+	int status = 0;
+	// Lock the program to prevent mutual sharing of resources by multiple threads simoultaneously
+	aesd_metrics_lock(&mutex_lock);
+	while(batch && (status == 0)){
+		int iovcnt = 0;
+		while(batch && (iovcnt < AESD_COMMIT_MAX_IOV)){
+			iov[iovcnt].iov_base = (void *) batch->packet;
+			iov[iovcnt].iov_len = batch->len;
+			iovcnt++;
+			batch = batch->next;
+		}
+		// append() moves the iovecs along partial writes, subscribers get the packets as queued
+		memcpy(published, iov, sizeof(struct iovec) * iovcnt);
+		status = commit_store.backend->append(&commit_store, iov, iovcnt);
+		if(status == 0){
+			aesd_subscribe_publish(published, iovcnt);
+		}
+	}
+	aesd_snapshot_bump();
+	// Once the process is complete, perform unlock for the data to be available the next time.
+	pthread_mutex_unlock(&mutex_lock);
+	// Only the file backend has anything to flush, the aesdchar device and the ring keep their data in memory
+	if((status == 0) && commit_store.backend->sync && (commit_store.backend->sync(&commit_store) < 0)){
+		perror("fdatasync failed");
+		status = -1;
+	}
+	return status;
+}
+
+/* Function	: aesd_committer
+ * Purpose	: body of the committer thread, write whatever is queued and release its submitters
+ */
+static void *aesd_committer(void *thread_param)
+{
+	while(1){
+		pthread_mutex_lock(&commit_lock);
+		while(!queue_head){
+			pthread_cond_wait(&commit_queued, &commit_lock);
+		}
+		aesd_commit_req_t *batch = queue_head;
+		queue_head = NULL;
+		queue_tail = NULL;
+		pthread_mutex_unlock(&commit_lock);
+
+		int status = aesd_commit_batch(batch);
+		aesd_metrics_add(AESD_METRIC_COMMIT_BATCHES, 1);
+		while(batch){
+			// done() may release the request, step past it first
+			aesd_commit_req_t *next = batch->next;
+			aesd_metrics_add(AESD_METRIC_COMMIT_PACKETS, 1);
+			aesd_metrics_record(AESD_METRIC_STORE_WRITE, batch->submitted_at);
+			batch->status = status;
+			batch->done(batch);
+			batch = next;
+		}
+	}
+	return thread_param;
+}
+
+// Start the committer thread, see aesd-commit.h
+int aesd_commit_start(void)
+{
+	if(open_store(&commit_store) < 0){
+		return -1;
+	}
+	if(pthread_create(&committer, NULL, &aesd_committer, NULL) != 0){
+		perror("Unable to start the committer thread");
+		close_store(&commit_store);
+		return -1;
+	}
+	return 0;
+}
+
+// Queue a packet for the next batch, see aesd-commit.h
+void aesd_commit_submit(aesd_commit_req_t *req)
+{
+	req->next = NULL;
+	req->submitted_at = aesd_metrics_now();
+	pthread_mutex_lock(&commit_lock);
+	if(queue_tail){
+		queue_tail->next = req;
+	}
+	else{
+		queue_head = req;
+	}
+	queue_tail = req;
+	pthread_cond_signal(&commit_queued);
+	pthread_mutex_unlock(&commit_lock);
+}
+
+/* Function	: aesd_commit_wake
+ * Purpose	: completion callback of aesd_commit_write(), wakes the waiting submitter
+ */
+static void aesd_commit_wake(aesd_commit_req_t *req)
+{
+	sem_post((sem_t *) req->owner);
+}
+
+// Queue a packet and wait for its batch, see aesd-commit.h
+int aesd_commit_write(const char *packet, size_t len)
+{
+	sem_t written;
+	aesd_commit_req_t req = { .packet = packet, .len = len, .done = &aesd_commit_wake, .owner = &written };
+	sem_init(&written, 0, 0);
+	aesd_commit_submit(&req);
+	while((sem_wait(&written) < 0) && (errno == EINTR));
+	sem_destroy(&written);
+	return req.status;
+}
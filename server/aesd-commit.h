@@ -0,0 +1,61 @@
+/* Name	:	Sricharan Kidambi S
+   File	:	aesd-commit.h
+   Brief	:	Group commit of packets to the store. Packets completed by any connection are queued and a single
+   		committer thread writes everything queued so far with one writev().
+*/
+
+#ifndef AESD_COMMIT_H
+#define AESD_COMMIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Upper bound of packets appended by one backend call, a larger batch is written with several calls
+#define AESD_COMMIT_MAX_IOV 1024
+
+typedef struct aesd_commit_req aesd_commit_req_t;
+
+// Completion callback, runs on the committer thread and must not block
+typedef void (*aesd_commit_done_t)(aesd_commit_req_t *req);
+
+struct aesd_commit_req
+{
+	/**
+	 * The complete packet, owned by the caller and left untouched until done() is called
+	 */
+	const char *packet;
+	size_t len;
+	/**
+	 * 0 once the packet is in the store, -1 when the batch holding it could not be written
+	 */
+	int status;
+	aesd_commit_done_t done;
+	/**
+	 * Free for the caller, typically the connection the packet belongs to
+	 */
+	void *owner;
+	/**
+	 * Set by aesd_commit_submit(), the store write latency is measured from here
+	 */
+	uint64_t submitted_at;
+	aesd_commit_req_t *next;
+};
+
+/* Function	: aesd_commit_start
+ * Purpose	: open the committer's store descriptor and start the committer thread
+ * Returns	: 0 on success, -1 on failure
+ */
+int aesd_commit_start(void);
+
+/* Function	: aesd_commit_submit
+ * Purpose	: queue a packet for the next batch, req->done is called once the batch is written
+ */
+void aesd_commit_submit(aesd_commit_req_t *req);
+
+/* Function	: aesd_commit_write
+ * Purpose	: queue a packet and wait until the batch holding it is written, for the blocking engine
+ * Returns	: the status of the request
+ */
+int aesd_commit_write(const char *packet, size_t len);
+
+#endif /* AESD_COMMIT_H */
@@ -0,0 +1,385 @@
+/* Name	:	Sricharan Kidambi S
+   File	:	aesd-drain.c
+   Brief	:	Graceful drain and hot restart of aesdsocket, see aesd-drain.h
+   References	:	https://man7.org/linux/man-pages/man7/unix.7.html - SCM_RIGHTS
+   Notes	:	1.	The SIGINT and SIGTERM handler only writes a byte to a pipe, everything else, logging and exiting
+   				included, happens on the drain thread.
+   			2.	A drain writes the eventfd of aesd_drain_fd(). Every acceptor waits on it next to its listener,
+   				stops accepting and calls aesd_drain_leave(). Only then are the listeners closed, so no connection
+   				is accepted after the drain started counting the open ones.
+   			3.	The drain waits until every connection closed or config.drain_deadline seconds passed, whatever
+   				comes first, and exits. Subscribers never finish on their own and are not waited for.
+   			4.	With -R the drain thread also serves a unix socket. A new server connecting to it gets the
+   				listening sockets as SCM_RIGHTS, acknowledges them with one byte and takes over the path, the old
+   				one then drains. Connections waiting in the backlog belong to the shared socket and are accepted
+   				by the new server.
+   			5.	The handoff socket is bound under a temporary name and renamed over the path, and a new server
+   				does that before its acknowledgement. The path never goes missing, so a restart right behind
+   				another one finds a server to take over from instead of binding port 9000 itself.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "aesdsocket.h"
+#include "aesd-drain.h"
+#include "aesd-metrics.h"
+#include "aesd-log.h"
+
+// How long an old server waits for the new one to acknowledge the listening sockets
+#define DRAIN_HANDOFF_TIMEOUT 5
+// Poll interval while waiting for acceptors and connections, in milliseconds
+#define DRAIN_POLL_INTERVAL 50
+// Byte of a drain request, an exit request is the signal number itself
+#define DRAIN_REQUEST_DRAIN 0
+
+typedef union drain_control
+{
+	struct cmsghdr align;
+	char buf[CMSG_SPACE(sizeof(int) * AESD_DRAIN_MAX_LISTENERS)];
+}drain_control_t;
+
+static int drain_request_pipe[2] = { -1, -1 };
+static int drain_event = -1;
+static int drain_handoff_fd = -1;
+static int drain_sockfds[AESD_DRAIN_MAX_LISTENERS];
+static int drain_nlisteners;
+static atomic_bool drain_requested;
+static atomic_bool drain_started;
+static atomic_bool drain_handoff_done;
+static atomic_int drain_acceptors;
+static pthread_t drain_thread;
+
+/* Function	: aesd_drain_address
+ * Purpose	: fill the address of the handoff socket
+ * Returns	: 0 on success, -1 when the path does not fit
+ */
+static int aesd_drain_address(struct sockaddr_un *handoff, const char *path)
+{
+	memset(handoff, 0, sizeof(struct sockaddr_un));
+	handoff->sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(handoff->sun_path)){
+		fprintf(stderr, "handoff socket path too long: %s\n", path);
+		return -1;
+	}
+	strcpy(handoff->sun_path, path);
+	return 0;
+}
+
+/* Function	: aesd_drain_listen
+ * Purpose	: bind drain_handoff_fd under a temporary name and rename it over config.handoff_socket, replacing the
+ *		  socket of the previous server without a moment in which the path is missing
+ * Returns	: 0 on success, -1 on failure
+ */
+static int aesd_drain_listen(void)
+{
+	struct sockaddr_un handoff;
+	char path[sizeof(handoff.sun_path)];
+	if((size_t) snprintf(path, sizeof(path), "%s.%d", config.handoff_socket, (int) getpid()) >= sizeof(path)){
+		fprintf(stderr, "handoff socket path too long: %s\n", config.handoff_socket);
+		return -1;
+	}
+	if(aesd_drain_address(&handoff, path) < 0){
+		return -1;
+	}
+	drain_handoff_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(drain_handoff_fd < 0){
+		perror("handoff socket");
+		return -1;
+	}
+	// Left behind by a server of the same pid which did not exit cleanly
+	unlink(path);
+	if((bind(drain_handoff_fd, (struct sockaddr *) &handoff, sizeof(handoff)) < 0) || (listen(drain_handoff_fd, 1) < 0) ||
+		(rename(path, config.handoff_socket) < 0)){
+		perror("handoff bind");
+		unlink(path);
+		close(drain_handoff_fd);
+		drain_handoff_fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+// Take the listeners over, see aesd-drain.h
+int aesd_drain_receive(const char *path, int *sockfds)
+{
+	struct sockaddr_un handoff;
+	if(aesd_drain_address(&handoff, path) < 0){
+		return -1;
+	}
+	uint64_t deadline = aesd_metrics_now() + DRAIN_HANDOFF_TIMEOUT * 1000000000ULL;
+	while(1){
+		int peer = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if(peer < 0){
+			perror("handoff socket");
+			return -1;
+		}
+		if(connect(peer, (struct sockaddr *) &handoff, sizeof(handoff)) < 0){
+			int error = errno;
+			close(peer);
+			// Nobody serves the path, this is the first server
+			if((error == ENOENT) || (error == ECONNREFUSED)){
+				return 0;
+			}
+			errno = error;
+			perror("handoff connect");
+			return -1;
+		}
+		int count = 0;
+		drain_control_t control;
+		struct iovec iov = { .iov_base = &count, .iov_len = sizeof(count) };
+		struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf, .msg_controllen = sizeof(control.buf) };
+		ssize_t received;
+		while(((received = recvmsg(peer, &msg, MSG_CMSG_CLOEXEC)) < 0) && (errno == EINTR));
+		if(((received == 0) || ((received < 0) && (errno == ECONNRESET))) && (aesd_metrics_now() < deadline)){
+			// The socket was handed to another new server meanwhile and closed, the path leads to that one now
+			close(peer);
+			struct timespec interval = { .tv_sec = 0, .tv_nsec = DRAIN_POLL_INTERVAL * 1000000L };
+			nanosleep(&interval, NULL);
+			continue;
+		}
+		struct cmsghdr *cmsg = (received == sizeof(count)) ? CMSG_FIRSTHDR(&msg) : NULL;
+		int passed = 0;
+		if(cmsg && (cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS)){
+			passed = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			memcpy(sockfds, CMSG_DATA(cmsg), passed * sizeof(int));
+		}
+		// The path is taken over before the acknowledgement lets the running server close its socket
+		if((passed == 0) || (passed != count) || (msg.msg_flags & MSG_CTRUNC) || (aesd_drain_listen() < 0) ||
+			(send(peer, "", 1, MSG_NOSIGNAL) != 1)){
+			fprintf(stderr, "Listening sockets could not be taken over from %s\n", path);
+			for(int i = 0; i < passed; i++){
+				close(sockfds[i]);
+			}
+			close(peer);
+			return -1;
+		}
+		close(peer);
+		return count;
+	}
+}
+
+/* Function	: aesd_drain_send
+ * Purpose	: pass the listening sockets to a new server connected to the handoff socket
+ * Returns	: 0 once the new server acknowledged them, -1 otherwise
+ */
+static int aesd_drain_send(int peer)
+{
+	int count = drain_nlisteners;
+	drain_control_t control;
+	memset(&control, 0, sizeof(control));
+	struct iovec iov = { .iov_base = &count, .iov_len = sizeof(count) };
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf, .msg_controllen = CMSG_SPACE(sizeof(int) * count) };
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+	memcpy(CMSG_DATA(cmsg), drain_sockfds, sizeof(int) * count);
+	struct timeval timeout = { .tv_sec = DRAIN_HANDOFF_TIMEOUT, .tv_usec = 0 };
+	setsockopt(peer, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	char ack;
+	if((sendmsg(peer, &msg, MSG_NOSIGNAL) != sizeof(count)) || (recv(peer, &ack, 1, 0) != 1)){
+		perror("handoff");
+		return -1;
+	}
+	return 0;
+}
+
+/* Function	: aesd_drain_sessions
+ * Purpose	: connections still open, subscribers left out
+ */
+static long long aesd_drain_sessions(void)
+{
+	return (long long)(aesd_metrics_total(AESD_METRIC_CONNECTIONS_OPENED) - aesd_metrics_total(AESD_METRIC_CONNECTIONS_CLOSED)) -
+		(long long)(aesd_metrics_total(AESD_METRIC_SUBSCRIBERS_OPENED) - aesd_metrics_total(AESD_METRIC_SUBSCRIBERS_CLOSED));
+}
+
+/* Function	: aesd_drain_exit
+ * Purpose	: leave at once for an exit request read from the pipe
+ */
+static void aesd_drain_exit(char request)
+{
+	AESD_LOG(LOG_INFO, "Caught signal %d", request);
+	aesd_exit();
+}
+
+/* Function	: aesd_drain_pause
+ * Purpose	: sleep DRAIN_POLL_INTERVAL between two checks of a drain, an exit request ends it at once
+ */
+static void aesd_drain_pause(void)
+{
+	struct pollfd ready = { .fd = drain_request_pipe[0], .events = POLLIN };
+	char request;
+	if((poll(&ready, 1, DRAIN_POLL_INTERVAL) > 0) && (read(drain_request_pipe[0], &request, 1) == 1) &&
+		(request != DRAIN_REQUEST_DRAIN)){
+		aesd_drain_exit(request);
+	}
+}
+
+/* Function	: aesd_drain_wait
+ * Purpose	: wait for the next request, a signal or a new server on the handoff socket
+ */
+static void aesd_drain_wait(void)
+{
+	struct pollfd ready[2] = {
+		{ .fd = drain_request_pipe[0], .events = POLLIN },
+		{ .fd = drain_handoff_fd, .events = POLLIN },
+	};
+	while(1){
+		if(poll(ready, 2, -1) < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			perror("drain poll");
+			return;
+		}
+		if(ready[0].revents){
+			char request;
+			if(read(drain_request_pipe[0], &request, 1) != 1){
+				continue;
+			}
+			if(request != DRAIN_REQUEST_DRAIN){
+				aesd_drain_exit(request);
+			}
+			AESD_LOG(LOG_INFO, "Caught signal %d, draining", SIGTERM);
+			return;
+		}
+		if(!(ready[1].revents & POLLIN)){
+			continue;
+		}
+		int peer = accept4(drain_handoff_fd, NULL, NULL, SOCK_CLOEXEC);
+		if(peer < 0){
+			continue;
+		}
+		// A SIGTERM arriving from now on exits at once, the listeners may already belong to the new server
+		if(atomic_exchange(&drain_requested, true)){
+			// SIGTERM came first, the new server finds no listeners to take over and binds its own
+			close(peer);
+			AESD_LOG(LOG_INFO, "Caught signal %d, draining", SIGTERM);
+			return;
+		}
+		int status = aesd_drain_send(peer);
+		close(peer);
+		if(status == 0){
+			atomic_store(&drain_handoff_done, true);
+			AESD_LOG(LOG_INFO, "Listening sockets handed over to a new server, draining");
+			return;
+		}
+		atomic_store(&drain_requested, false);
+	}
+}
+
+/* Function	: aesd_drain_run
+ * Purpose	: body of the drain thread
+ */
+static void *aesd_drain_run(void *thread_param)
+{
+	aesd_drain_wait();
+	if(drain_handoff_fd >= 0){
+		// Closed but not unlinked, the new server renamed its own socket over the path
+		close(drain_handoff_fd);
+	}
+	atomic_store(&drain_started, true);
+	eventfd_write(drain_event, 1);
+	uint64_t deadline = aesd_metrics_now() + (uint64_t) config.drain_deadline * 1000000000ULL;
+	while((atomic_load(&drain_acceptors) > 0) && (aesd_metrics_now() < deadline)){
+		aesd_drain_pause();
+	}
+	// A handed over socket lives on in the new server, otherwise the backlog is refused from here on
+	for(int i = 0; i < drain_nlisteners; i++){
+		close(drain_sockfds[i]);
+	}
+	long long sessions;
+	while(((sessions = aesd_drain_sessions()) > 0) && (aesd_metrics_now() < deadline)){
+		aesd_drain_pause();
+	}
+	AESD_LOG(LOG_INFO, "Drain done, %lld connection(s) cut off", (sessions > 0) ? sessions : 0);
+	aesd_exit();
+	return thread_param;
+}
+
+// Create the request pipe, see aesd-drain.h
+int aesd_drain_init(void)
+{
+	if(pipe2(drain_request_pipe, O_CLOEXEC) < 0){
+		perror("pipe");
+		return -1;
+	}
+	return 0;
+}
+
+// Start the drain thread, see aesd-drain.h
+int aesd_drain_start(const int *sockfds, int nlisteners)
+{
+	if(nlisteners > AESD_DRAIN_MAX_LISTENERS){
+		fprintf(stderr, "At most %d listeners can be drained\n", AESD_DRAIN_MAX_LISTENERS);
+		return -1;
+	}
+	memcpy(drain_sockfds, sockfds, sizeof(int) * nlisteners);
+	drain_nlisteners = nlisteners;
+	drain_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(drain_event < 0){
+		perror("eventfd");
+		return -1;
+	}
+	// After a handoff aesd_drain_receive() already serves the path, a stale socket of a server which did not exit
+	// cleanly is replaced
+	if(config.handoff_socket && (drain_handoff_fd < 0) && (aesd_drain_listen() < 0)){
+		return -1;
+	}
+	if(pthread_create(&drain_thread, NULL, &aesd_drain_run, NULL) != 0){
+		perror("Unable to start the drain thread");
+		return -1;
+	}
+	return 0;
+}
+
+// Ask for a drain, see aesd-drain.h
+bool aesd_drain_request(int signo)
+{
+	if(drain_request_pipe[1] < 0){
+		return false;
+	}
+	char request = ((signo == SIGTERM) && !atomic_exchange(&drain_requested, true)) ? DRAIN_REQUEST_DRAIN : (char) signo;
+	return write(drain_request_pipe[1], &request, 1) == 1;
+}
+
+// Readable once draining, see aesd-drain.h
+int aesd_drain_fd(void)
+{
+	return drain_event;
+}
+
+// Drain state, see aesd-drain.h
+bool aesd_draining(void)
+{
+	return atomic_load(&drain_started);
+}
+
+bool aesd_drain_handed_off(void)
+{
+	return atomic_load(&drain_handoff_done);
+}
+
+// Acceptor bookkeeping, see aesd-drain.h
+void aesd_drain_join(void)
+{
+	atomic_fetch_add(&drain_acceptors, 1);
+}
+
+void aesd_drain_leave(void)
+{
+	atomic_fetch_sub(&drain_acceptors, 1);
+}
@@ -0,0 +1,69 @@
+/* Name	:	Sricharan Kidambi S
+   File	:	aesd-drain.h
+   Brief	:	Graceful drain and hot restart of aesdsocket. SIGTERM stops accepting and lets the open connections
+   		finish within a deadline before the server exits. A new server started with the same -R socket takes the
+   		listening sockets over from the running one, which then drains the same way, so no connection is refused.
+*/
+
+#ifndef AESD_DRAIN_H
+#define AESD_DRAIN_H
+
+#include <stdbool.h>
+
+// Seconds open connections get to finish after a drain started when -D is not given
+#define AESD_DRAIN_DEFAULT_DEADLINE 30
+// Listening sockets one handoff carries at most
+#define AESD_DRAIN_MAX_LISTENERS 64
+
+/* Function	: aesd_drain_receive
+ * Purpose	: take the listening sockets over from a server serving the handoff socket at path. The handoff socket
+ *		  of this server replaces it at path before the running server is acknowledged and starts draining.
+ * Parameters	: the handoff socket, array of AESD_DRAIN_MAX_LISTENERS descriptors to fill
+ * Returns	: the number of listening sockets received, 0 when no server answers at path, -1 on failure
+ */
+int aesd_drain_receive(const char *path, int *sockfds);
+
+/* Function	: aesd_drain_init
+ * Purpose	: create the pipe aesd_drain_request() writes to, before the signal handlers are installed. Requests
+ *		  made before aesd_drain_start() wait in the pipe.
+ * Returns	: 0 on success, -1 on failure
+ */
+int aesd_drain_init(void);
+
+/* Function	: aesd_drain_start
+ * Purpose	: start the drain thread. It waits for aesd_drain_request() and, with config.handoff_socket, serves the
+ *		  handoff socket to the next server.
+ * Parameters	: the listening sockets of this server and their number
+ * Returns	: 0 on success, -1 on failure
+ */
+int aesd_drain_start(const int *sockfds, int nlisteners);
+
+/* Function	: aesd_drain_request
+ * Purpose	: hand a signal to the drain thread. The first SIGTERM drains, SIGINT and any later SIGTERM make the drain
+ *		  thread log and exit at once, also in the middle of a drain. Async signal safe, only writes a byte.
+ * Parameters	: the signal caught
+ * Returns	: true when the request was queued, false when there is no pipe, the caller has to _exit() then
+ */
+bool aesd_drain_request(int signo);
+
+/* Function	: aesd_drain_fd
+ * Purpose	: eventfd which becomes readable, and stays readable, once a drain started. Engines wait on it next to
+ *		  their listening socket.
+ */
+int aesd_drain_fd(void);
+
+/* Function	: aesd_draining / aesd_drain_handed_off
+ * Purpose	: whether a drain started, and whether it started because the listening sockets went to a new server,
+ *		  which then owns the store file and the admin socket
+ */
+bool aesd_draining(void);
+bool aesd_drain_handed_off(void);
+
+/* Function	: aesd_drain_join / aesd_drain_leave
+ * Purpose	: an acceptor (acceptor thread, event loop, ring) starts accepting, and stops for good after it saw
+ *		  aesd_drain_fd() become readable. The drain only waits for connections once every acceptor left.
+ */
+void aesd_drain_join(void);
+void aesd_drain_leave(void);
+
+#endif /* AESD_DRAIN_H */
@@ -0,0 +1,73 @@
+/* Name	:	Sricharan Kidambi S
+   File	:	aesd-frame.h
+   Brief	:	Length prefixed binary framing of the aesdsocket protocol, chosen per connection by its first byte. A
+   		connection starting with AESD_FRAME_MAGIC speaks frames for its whole lifetime, any other first byte keeps
+   		the '\n' terminated text protocol.
+   Notes	:	1.	Every frame is an 8 byte header followed by the payload, all integers in network byte order:
+   				byte 0 AESD_FRAME_MAGIC, byte 1 opcode, bytes 2-3 zero, bytes 4-7 payload length.
+   			2.	Requests:
+   				AESD_OP_WRITE		the payload is appended to the store as one packet (the aesdchar driver
+   							still ends its entries at '\n'), the response is the whole store
+   				AESD_OP_SEEK_READ	u32 write_cmd, u32 write_cmd_offset, AESDCHAR_IOCSEEKTO:X,Y without
+   							parsing text, the response is the store from there to its end
+   				AESD_OP_RANGE_READ	u64 offset, u64 length, the response is that window of the store
+   				AESD_OP_ENTRY_READ	u32 write_cmd, u32 write_cmd_offset, u32 write_cmd_count, the binary
+   							AESDCHAR_IOCRANGE:X,Y,N, the response is that many packets
+   			3.	A response is a sequence of AESD_OP_DATA frames ended by an AESD_OP_DATA frame of length 0, so the
+   				server never has to know the size of the store up front.
+   			4.	A request which can not be carried out closes the connection, as in the text protocol.
+*/
+
+#ifndef AESD_FRAME_H
+#define AESD_FRAME_H
+
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#define AESD_FRAME_MAGIC	0xAE
+#define AESD_FRAME_HEADER_SIZE	8
+// Larger frames are rejected before any of their payload is buffered. aesdchar copies a write into one kmalloc()
+// buffer, so a store packet much larger than this could not be written to the device anyway.
+#define AESD_FRAME_MAX_PAYLOAD	(1024u * 1024)
+
+typedef enum aesd_opcode
+{
+	AESD_OP_TEXT		= 0x00,	// not on the wire, a '\n' terminated packet of the text protocol
+	AESD_OP_WRITE		= 0x01,
+	AESD_OP_SEEK_READ	= 0x02,
+	AESD_OP_RANGE_READ	= 0x03,
+	AESD_OP_ENTRY_READ	= 0x04,
+	AESD_OP_DATA		= 0x81,
+	AESD_OP_INVALID		= 0xFF,	// not on the wire, a header which can not be parsed
+}aesd_opcode_t;
+
+/* Function	: aesd_frame_header
+ * Purpose	: encode a frame header into AESD_FRAME_HEADER_SIZE bytes at out
+ */
+static inline void aesd_frame_header(char *out, uint8_t opcode, uint32_t length)
+{
+	uint32_t wire_length = htonl(length);
+	out[0] = (char) AESD_FRAME_MAGIC;
+	out[1] = (char) opcode;
+	out[2] = 0;
+	out[3] = 0;
+	memcpy(out + 4, &wire_length, sizeof(wire_length));
+}
+
+/* Function	: aesd_frame_u32 / aesd_frame_u64
+ * Purpose	: decode a network byte order integer of a payload, which may be unaligned
+ */
+static inline uint32_t aesd_frame_u32(const char *in)
+{
+	uint32_t value;
+	memcpy(&value, in, sizeof(value));
+	return ntohl(value);
+}
+
+static inline uint64_t aesd_frame_u64(const char *in)
+{
+	return ((uint64_t) aesd_frame_u32(in) << 32) | aesd_frame_u32(in + 4);
+}
+
+#endif /* AESD_FRAME_H */
@@ -0,0 +1,214 @@
+/* Name	:	Sricharan Kidambi S
+   File	:	aesd-log.c
+   Brief	:	Asynchronous logger of aesdsocket, see aesd-log.h
+   Notes	:	1.	Each thread allocates its own ring on its first message and pushes it on a global list, like the
+   				metrics blocks the rings live as long as the process. The thread is the only producer of its ring
+   				and the drainer the only consumer, so a message costs a vsnprintf() and two atomic stores.
+   			2.	The drainer sleeps on an eventfd only after it found every ring empty twice with log_sleeping set
+   				in between. A producer wakes it only when it sees log_sleeping, the first message after an idle
+   				period costs one eventfd write and a busy server none.
+   			3.	Messages of one thread keep their order, messages of different threads are written ring by ring.
+   				Every message carries the time it was logged, a file gets that time, syslog its own.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include "aesd-log.h"
+#include "aesd-metrics.h"
+
+typedef struct aesd_log_record
+{
+	struct timespec logged;
+	int priority;
+	char text[AESD_LOG_LINE];
+}aesd_log_record_t;
+
+typedef struct aesd_log_ring
+{
+	/**
+	 * Messages queued so far, written by the owning thread only
+	 */
+	_Atomic uint32_t head;
+	/**
+	 * Messages written out so far, written by the drainer only
+	 */
+	_Atomic uint32_t tail;
+	aesd_log_record_t records[AESD_LOG_RING_SLOTS];
+	struct aesd_log_ring *next;
+}aesd_log_ring_t;
+
+static const char *priority_names[] = {
+	[LOG_EMERG] = "emerg",
+	[LOG_ALERT] = "alert",
+	[LOG_CRIT] = "crit",
+	[LOG_ERR] = "err",
+	[LOG_WARNING] = "warning",
+	[LOG_NOTICE] = "notice",
+	[LOG_INFO] = "info",
+	[LOG_DEBUG] = "debug",
+};
+
+static _Atomic(aesd_log_ring_t *) log_rings;
+static __thread aesd_log_ring_t *log_self;
+// Held by whoever consumes the rings, the drainer or aesd_log_flush()
+static pthread_mutex_t log_drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_bool log_sleeping;
+static int log_wakeup = -1;
+// NULL while messages go to syslog
+static FILE *log_file;
+static pthread_t log_thread;
+
+/* Function	: aesd_log_ring
+ * Purpose	: ring of the calling thread, allocated and published on first use
+ * Returns	: NULL when it could not be allocated, the message is dropped then
+ */
+static aesd_log_ring_t *aesd_log_ring(void)
+{
+	if(log_self){
+		return log_self;
+	}
+	aesd_log_ring_t *self = (aesd_log_ring_t *) calloc(1, sizeof(aesd_log_ring_t));
+	if(!self){
+		return NULL;
+	}
+	self->next = atomic_load(&log_rings);
+	while(!atomic_compare_exchange_weak(&log_rings, &self->next, self));
+	log_self = self;
+	return self;
+}
+
+// Queue a message, see aesd-log.h
+void aesd_log(int priority, const char *format, ...)
+{
+	aesd_log_ring_t *ring = aesd_log_ring();
+	if(!ring){
+		aesd_metrics_add(AESD_METRIC_LOG_DROPPED, 1);
+		return;
+	}
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	if(head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= AESD_LOG_RING_SLOTS){
+		aesd_metrics_add(AESD_METRIC_LOG_DROPPED, 1);
+		return;
+	}
+	aesd_log_record_t *record = &ring->records[head % AESD_LOG_RING_SLOTS];
+	clock_gettime(CLOCK_REALTIME, &record->logged);
+	record->priority = priority;
+	va_list args;
+	va_start(args, format);
+	vsnprintf(record->text, sizeof(record->text), format, args);
+	va_end(args);
+	// Sequentially consistent, the drainer sets log_sleeping before it looks at head for the last time
+	atomic_store(&ring->head, head + 1);
+	if(atomic_load(&log_sleeping) && atomic_exchange(&log_sleeping, false) && (log_wakeup >= 0)){
+		eventfd_write(log_wakeup, 1);
+	}
+}
+
+/* Function	: aesd_log_write
+ * Purpose	: write one message to the file or to syslog
+ */
+static void aesd_log_write(const aesd_log_record_t *record)
+{
+	if(!log_file){
+		syslog(record->priority, "%s", record->text);
+		return;
+	}
+	struct tm local;
+	char stamp[32];
+	localtime_r(&record->logged.tv_sec, &local);
+	strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+	fprintf(log_file, "%s.%06ld %s %s\n", stamp, record->logged.tv_nsec / 1000, priority_names[LOG_PRI(record->priority)], record->text);
+}
+
+/* Function	: aesd_log_drain
+ * Purpose	: write out every message queued in any ring, the caller holds log_drain_lock
+ * Returns	: the number of messages written
+ */
+static unsigned aesd_log_drain(void)
+{
+	unsigned written = 0;
+	for(aesd_log_ring_t *ring = atomic_load(&log_rings); ring; ring = ring->next){
+		uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		uint32_t head = atomic_load(&ring->head);
+		while(tail != head){
+			aesd_log_write(&ring->records[tail % AESD_LOG_RING_SLOTS]);
+			tail++;
+			written++;
+			// Hand the slot back at once, a long drain should not make the producer drop messages
+			atomic_store_explicit(&ring->tail, tail, memory_order_release);
+		}
+	}
+	if(log_file && written){
+		fflush(log_file);
+	}
+	return written;
+}
+
+/* Function	: aesd_log_drainer
+ * Purpose	: body of the drainer thread
+ */
+static void *aesd_log_drainer(void *thread_param)
+{
+	while(1){
+		pthread_mutex_lock(&log_drain_lock);
+		unsigned written = aesd_log_drain();
+		pthread_mutex_unlock(&log_drain_lock);
+		if(written){
+			continue;
+		}
+		// Announce the sleep, then look once more so a message queued in between is not left behind
+		atomic_store(&log_sleeping, true);
+		pthread_mutex_lock(&log_drain_lock);
+		written = aesd_log_drain();
+		pthread_mutex_unlock(&log_drain_lock);
+		if(written){
+			atomic_store(&log_sleeping, false);
+			continue;
+		}
+		eventfd_t wakeups;
+		while((eventfd_read(log_wakeup, &wakeups) < 0) && (errno == EINTR));
+	}
+	return thread_param;
+}
+
+// Start the drainer, see aesd-log.h
+int aesd_log_start(const char *path)
+{
+	if(path){
+		log_file = fopen(path, "ae");
+		if(!log_file){
+			perror("Unable to open the log file");
+			return -1;
+		}
+	}
+	log_wakeup = eventfd(0, EFD_CLOEXEC);
+	if(log_wakeup < 0){
+		perror("eventfd");
+		return -1;
+	}
+	if(pthread_create(&log_thread, NULL, &aesd_log_drainer, NULL) != 0){
+		perror("Unable to start the log thread");
+		close(log_wakeup);
+		log_wakeup = -1;
+		return -1;
+	}
+	return 0;
+}
+
+// Write out what is queued, see aesd-log.h
+void aesd_log_flush(void)
+{
+	if(pthread_mutex_trylock(&log_drain_lock) != 0){
+		return;
+	}
+	aesd_log_drain();
+	pthread_mutex_unlock(&log_drain_lock);
+}
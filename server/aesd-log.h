@@ -0,0 +1,53 @@
+/* Name	:	Sricharan Kidambi S
+   File	:	aesd-log.h
+   Brief	:	Logging of aesdsocket which never blocks the thread serving a request. A message is formatted into a ring
+   		of the calling thread and written to syslog or a file later by a drainer thread.
+   Notes	:	1.	Priorities are the syslog ones. Messages less important than AESD_LOG_LEVEL are compiled out, build
+   				with make LOG_LEVEL=LOG_INFO to drop the per packet and per connection messages.
+   			2.	A message finding the ring of its thread full is dropped and counted in AESD_METRIC_LOG_DROPPED.
+*/
+
+#ifndef AESD_LOG_H
+#define AESD_LOG_H
+
+#include <stdbool.h>
+#include <syslog.h>
+
+#ifndef AESD_LOG_LEVEL
+#define AESD_LOG_LEVEL LOG_DEBUG
+#endif
+
+// Messages every thread may have queued before it drops them
+#define AESD_LOG_RING_SLOTS 256
+// Longest message, longer ones are truncated
+#define AESD_LOG_LINE 200
+
+/* Function	: AESD_LOG
+ * Purpose	: log a printf style message with a syslog priority, nothing is compiled in below AESD_LOG_LEVEL
+ */
+#define AESD_LOG(priority, ...) do { \
+		if((priority) <= AESD_LOG_LEVEL){ \
+			aesd_log((priority), __VA_ARGS__); \
+		} \
+	} while(0)
+
+/* Function	: aesd_log
+ * Purpose	: queue a message in the ring of the calling thread, use AESD_LOG() instead
+ */
+void aesd_log(int priority, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/* Function	: aesd_log_start
+ * Purpose	: start the drainer thread, messages logged before are kept and written once it runs. Call it after
+ *		  daemonizing, the thread would not survive the fork.
+ * Parameters	: file to append the messages to, NULL for syslog
+ * Returns	: 0 on success, -1 on failure
+ */
+int aesd_log_start(const char *path);
+
+/* Function	: aesd_log_flush
+ * Purpose	: write every queued message now, called on the way out of the process. It gives up instead of waiting
+ *		  when the drainer is busy, the signal handler may have interrupted the drainer itself.
+ */
+void aesd_log_flush(void);
+
+#endif /* AESD_LOG_H */
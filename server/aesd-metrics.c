@@ -0,0 +1,377 @@
+/* Name	:	Sricharan Kidambi S
+   File	:	aesd-metrics.c
+   Brief	:	Metrics of aesdsocket, reported on the admin socket given with -a
+   References	:	http://hdrhistogram.org/ - log linear bucketing of latencies
+   Notes	:	1.	Each thread allocates its own block of counters on its first update and pushes it on a global list,
+   				the blocks live as long as the process. Only the owning thread writes a block, so an update is a
+   				relaxed load and store of a thread local cache line, no lock and no atomic read-modify-write.
+   			2.	A report reads every block with relaxed loads. Counters of a thread which is updating them at the
+   				same time may be one event behind, which is fine for monitoring.
+   			3.	Latencies are kept in nanoseconds in log linear buckets: values below 2^AESD_METRICS_SUB_BITS have a
+   				bucket each, above that every power of two is split into 2^AESD_METRICS_SUB_BITS buckets. Percentiles
+   				report the highest value of their bucket, capped to the largest recorded value.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "aesd-metrics.h"
+#include "aesd-log.h"
+
+#define METRICS_SUB_BUCKETS (1 << AESD_METRICS_SUB_BITS)
+
+typedef struct aesd_metrics_histogram_data
+{
+	_Atomic uint64_t buckets[AESD_METRICS_BUCKETS];
+	_Atomic uint64_t sum;
+	_Atomic uint64_t max;
+}aesd_metrics_histogram_data_t;
+
+typedef struct aesd_metrics_thread
+{
+	_Atomic uint64_t counters[AESD_METRIC_COUNTERS];
+	aesd_metrics_histogram_data_t histograms[AESD_METRIC_HISTOGRAMS];
+	struct aesd_metrics_thread *next;
+}aesd_metrics_thread_t;
+
+static const char *counter_names[AESD_METRIC_COUNTERS] = {
+	[AESD_METRIC_BYTES_IN] = "bytes_in",
+	[AESD_METRIC_BYTES_OUT] = "bytes_out",
+	[AESD_METRIC_PACKETS] = "packets",
+	[AESD_METRIC_CONNECTIONS_OPENED] = "connections_opened",
+	[AESD_METRIC_CONNECTIONS_CLOSED] = "connections_closed",
+	[AESD_METRIC_POOL_QUEUED] = "pool_queued",
+	[AESD_METRIC_POOL_DEQUEUED] = "pool_dequeued",
+	[AESD_METRIC_COMMIT_BATCHES] = "commit_batches",
+	[AESD_METRIC_COMMIT_PACKETS] = "commit_packets",
+	[AESD_METRIC_MUTEX_WAIT_NS] = "mutex_wait_ns",
+	[AESD_METRIC_SNAPSHOT_HITS] = "snapshot_hits",
+	[AESD_METRIC_SNAPSHOT_READS] = "snapshot_reads",
+	[AESD_METRIC_SUBSCRIBERS_OPENED] = "subscribers_opened",
+	[AESD_METRIC_SUBSCRIBERS_CLOSED] = "subscribers_closed",
+	[AESD_METRIC_SUBSCRIBE_DROPPED] = "subscribe_dropped",
+	[AESD_METRIC_SUBSCRIBE_DISCONNECTS] = "subscribe_disconnects",
+	[AESD_METRIC_LOG_DROPPED] = "log_dropped",
+	[AESD_METRIC_ARENAS_CREATED] = "arenas_created",
+	[AESD_METRIC_ARENAS_RECYCLED] = "arenas_recycled",
+	[AESD_METRIC_ARENAS_RETURNED] = "arenas_returned",
+	[AESD_METRIC_ARENAS_FREED] = "arenas_freed",
+	[AESD_METRIC_ARENA_OVERFLOWS] = "arena_overflows",
+	[AESD_METRIC_OUTPUT_PAUSES] = "output_pauses",
+};
+
+static const char *histogram_names[AESD_METRIC_HISTOGRAMS] = {
+	[AESD_METRIC_ACCEPT_TO_FIRST_BYTE] = "accept_to_first_byte",
+	[AESD_METRIC_RECEIVE] = "receive",
+	[AESD_METRIC_STORE_WRITE] = "store_write",
+	[AESD_METRIC_SEND] = "send",
+};
+
+static _Atomic(aesd_metrics_thread_t *) metrics_threads;
+static __thread aesd_metrics_thread_t *metrics_self;
+static int admin_fd = -1;
+static pthread_t admin_thread;
+
+/* Function	: aesd_metrics_thread
+ * Purpose	: counters of the calling thread, allocated and published on first use
+ * Returns	: NULL when they could not be allocated, the update is dropped then
+ */
+static aesd_metrics_thread_t *aesd_metrics_thread(void)
+{
+	if(metrics_self){
+		return metrics_self;
+	}
+	aesd_metrics_thread_t *self = (aesd_metrics_thread_t *) calloc(1, sizeof(aesd_metrics_thread_t));
+	if(!self){
+		return NULL;
+	}
+	self->next = atomic_load(&metrics_threads);
+	while(!atomic_compare_exchange_weak(&metrics_threads, &self->next, self));
+	metrics_self = self;
+	return self;
+}
+
+/* Function	: aesd_metrics_bump
+ * Purpose	: add to a value only the calling thread writes
+ */
+static inline void aesd_metrics_bump(_Atomic uint64_t *value, uint64_t add)
+{
+	atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + add, memory_order_relaxed);
+}
+
+/* Function	: aesd_metrics_bucket / aesd_metrics_bucket_top
+ * Purpose	: bucket of a latency, and the highest latency falling into a bucket
+ */
+static unsigned aesd_metrics_bucket(uint64_t value)
+{
+	if(value < METRICS_SUB_BUCKETS){
+		return (unsigned) value;
+	}
+	unsigned shift = 63 - __builtin_clzll(value) - AESD_METRICS_SUB_BITS;
+	return (shift << AESD_METRICS_SUB_BITS) + (unsigned)(value >> shift);
+}
+
+static uint64_t aesd_metrics_bucket_top(unsigned bucket)
+{
+	if(bucket < 2 * METRICS_SUB_BUCKETS){
+		return bucket;
+	}
+	unsigned shift = (bucket >> AESD_METRICS_SUB_BITS) - 1;
+	uint64_t mantissa = (bucket & (METRICS_SUB_BUCKETS - 1)) + METRICS_SUB_BUCKETS;
+	return ((mantissa + 1) << shift) - 1;
+}
+
+// Monotonic time in nanoseconds, see aesd-metrics.h
+uint64_t aesd_metrics_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// Add to a counter of this thread, see aesd-metrics.h
+void aesd_metrics_add(aesd_metrics_counter_t counter, uint64_t value)
+{
+	aesd_metrics_thread_t *self = aesd_metrics_thread();
+	if(self){
+		aesd_metrics_bump(&self->counters[counter], value);
+	}
+}
+
+// Sum of a counter over all threads, see aesd-metrics.h
+uint64_t aesd_metrics_total(aesd_metrics_counter_t counter)
+{
+	uint64_t total = 0;
+	for(aesd_metrics_thread_t *thread = atomic_load(&metrics_threads); thread; thread = thread->next){
+		total += atomic_load_explicit(&thread->counters[counter], memory_order_relaxed);
+	}
+	return total;
+}
+
+// Record a latency of this thread, see aesd-metrics.h
+void aesd_metrics_record(aesd_metrics_histogram_t histogram, uint64_t started)
+{
+	aesd_metrics_thread_t *self = aesd_metrics_thread();
+	if(!self){
+		return;
+	}
+	uint64_t now = aesd_metrics_now();
+	uint64_t elapsed = (now > started) ? now - started : 0;
+	aesd_metrics_histogram_data_t *data = &self->histograms[histogram];
+	aesd_metrics_bump(&data->buckets[aesd_metrics_bucket(elapsed)], 1);
+	aesd_metrics_bump(&data->sum, elapsed);
+	if(elapsed > atomic_load_explicit(&data->max, memory_order_relaxed)){
+		atomic_store_explicit(&data->max, elapsed, memory_order_relaxed);
+	}
+}
+
+// Lock and account the wait, see aesd-metrics.h
+void aesd_metrics_lock(pthread_mutex_t *lock)
+{
+	// Only a contended lock is timed, the common case stays a single trylock
+	if(pthread_mutex_trylock(lock) == 0){
+		return;
+	}
+	uint64_t started = aesd_metrics_now();
+	pthread_mutex_lock(lock);
+	aesd_metrics_add(AESD_METRIC_MUTEX_WAIT_NS, aesd_metrics_now() - started);
+}
+
+/* Function	: aesd_metrics_percentile
+ * Purpose	: latency below which the fraction q of the merged samples falls
+ */
+static uint64_t aesd_metrics_percentile(const uint64_t *buckets, uint64_t count, uint64_t max, double q)
+{
+	uint64_t rank = (uint64_t)(q * count + 0.999999);
+	uint64_t seen = 0;
+	for(unsigned i = 0; i < AESD_METRICS_BUCKETS; i++){
+		seen += buckets[i];
+		if(seen >= rank){
+			uint64_t top = aesd_metrics_bucket_top(i);
+			return (top < max) ? top : max;
+		}
+	}
+	return max;
+}
+
+// Write the report, see aesd-metrics.h
+int aesd_metrics_report(int report_fd)
+{
+	uint64_t counters[AESD_METRIC_COUNTERS] = {0};
+	static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+	uint64_t *buckets = (uint64_t *) malloc(sizeof(uint64_t) * AESD_METRICS_BUCKETS);
+	if(!buckets){
+		return -1;
+	}
+	for(aesd_metrics_thread_t *thread = atomic_load(&metrics_threads); thread; thread = thread->next){
+		for(int c = 0; c < AESD_METRIC_COUNTERS; c++){
+			counters[c] += atomic_load_explicit(&thread->counters[c], memory_order_relaxed);
+		}
+	}
+	int status = 0;
+	for(int c = 0; (c < AESD_METRIC_COUNTERS) && (status >= 0); c++){
+		status = dprintf(report_fd, "%s %llu\n", counter_names[c], (unsigned long long) counters[c]);
+	}
+	if(status >= 0){
+		// An arena is in use from its creation or recycling until it is returned, idle from then until it is freed
+		long long arenas_active = (long long)(counters[AESD_METRIC_ARENAS_CREATED] + counters[AESD_METRIC_ARENAS_RECYCLED] - counters[AESD_METRIC_ARENAS_RETURNED]);
+		status = dprintf(report_fd, "connections_active %lld\npool_depth %lld\nsubscribers_active %lld\narenas_active %lld\narenas_idle %lld\n",
+			(long long)(counters[AESD_METRIC_CONNECTIONS_OPENED] - counters[AESD_METRIC_CONNECTIONS_CLOSED]),
+			(long long)(counters[AESD_METRIC_POOL_QUEUED] - counters[AESD_METRIC_POOL_DEQUEUED]),
+			(long long)(counters[AESD_METRIC_SUBSCRIBERS_OPENED] - counters[AESD_METRIC_SUBSCRIBERS_CLOSED]),
+			arenas_active,
+			(long long)(counters[AESD_METRIC_ARENAS_CREATED] - counters[AESD_METRIC_ARENAS_FREED]) - arenas_active);
+	}
+	for(int h = 0; (h < AESD_METRIC_HISTOGRAMS) && (status >= 0); h++){
+		uint64_t count = 0, sum = 0, max = 0;
+		memset(buckets, 0, sizeof(uint64_t) * AESD_METRICS_BUCKETS);
+		for(aesd_metrics_thread_t *thread = atomic_load(&metrics_threads); thread; thread = thread->next){
+			aesd_metrics_histogram_data_t *data = &thread->histograms[h];
+			for(unsigned i = 0; i < AESD_METRICS_BUCKETS; i++){
+				uint64_t samples = atomic_load_explicit(&data->buckets[i], memory_order_relaxed);
+				buckets[i] += samples;
+				count += samples;
+			}
+			sum += atomic_load_explicit(&data->sum, memory_order_relaxed);
+			uint64_t thread_max = atomic_load_explicit(&data->max, memory_order_relaxed);
+			max = (thread_max > max) ? thread_max : max;
+		}
+		status = dprintf(report_fd, "latency_us %s count=%llu mean=%.1f", histogram_names[h], (unsigned long long) count,
+			count ? (double) sum / count / 1000.0 : 0.0);
+		for(size_t q = 0; (q < sizeof(quantiles) / sizeof(quantiles[0])) && (status >= 0); q++){
+			status = dprintf(report_fd, " p%g=%.1f", quantiles[q] * 100,
+				count ? aesd_metrics_percentile(buckets, count, max, quantiles[q]) / 1000.0 : 0.0);
+		}
+		if(status >= 0){
+			status = dprintf(report_fd, " max=%.1f\n", max / 1000.0);
+		}
+	}
+	free(buckets);
+	return (status < 0) ? -1 : 0;
+}
+
+/* Function	: aesd_metrics_admin
+ * Purpose	: body of the admin thread, every connection gets one report and is closed
+ */
+static void *aesd_metrics_admin(void *thread_param)
+{
+	while(1){
+		int clientfd = accept(admin_fd, NULL, NULL);
+		if(clientfd < 0){
+			if((errno == EINTR) || (errno == ECONNABORTED)){
+				continue;
+			}
+			perror("admin accept");
+			break;
+		}
+		aesd_metrics_report(clientfd);
+		close(clientfd);
+	}
+	return thread_param;
+}
+
+/* Function	: aesd_metrics_stale
+ * Purpose	: decide whether the admin socket path may be taken. A socket a server still listens on, or anything
+ *		  which is not a socket, is left alone.
+ * Parameters	: the address of the admin socket, whether a live socket is expected and may be replaced
+ * Returns	: 1 when a socket nobody listens on has to be removed first, 0 when the path is free or is replaced by
+ *		  rename(), -1 when it must not be touched
+ */
+static int aesd_metrics_stale(const struct sockaddr_un *admin, bool replace)
+{
+	struct stat st;
+	if(lstat(admin->sun_path, &st) < 0){
+		if(errno == ENOENT){
+			return 0;
+		}
+		perror("admin socket");
+		return -1;
+	}
+	if(!S_ISSOCK(st.st_mode)){
+		fprintf(stderr, "admin socket path %s exists and is not a socket\n", admin->sun_path);
+		return -1;
+	}
+	if(replace){
+		return 0;
+	}
+	int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(probe < 0){
+		perror("admin socket");
+		return -1;
+	}
+	int status = connect(probe, (const struct sockaddr *) admin, sizeof(*admin));
+	int probe_errno = errno;
+	close(probe);
+	if(status == 0){
+		fprintf(stderr, "admin socket %s is in use by a running server\n", admin->sun_path);
+		return -1;
+	}
+	if(probe_errno != ECONNREFUSED){
+		errno = probe_errno;
+		perror("admin socket");
+		return -1;
+	}
+	// Left behind by a server which did not exit cleanly
+	return 1;
+}
+
+// Start the admin socket, see aesd-metrics.h
+int aesd_metrics_serve(const char *path, bool replace)
+{
+	struct sockaddr_un admin;
+	struct sockaddr_un bound;
+	memset(&admin, 0, sizeof(admin));
+	admin.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(admin.sun_path)){
+		fprintf(stderr, "admin socket path too long: %s\n", path);
+		return -1;
+	}
+	strcpy(admin.sun_path, path);
+	int stale = aesd_metrics_stale(&admin, replace);
+	if(stale < 0){
+		return -1;
+	}
+	if(stale > 0){
+		unlink(path);
+	}
+	// The socket of the server handing over is replaced by renaming a bound one over it, the path never goes missing
+	bound = admin;
+	if(replace && ((size_t) snprintf(bound.sun_path, sizeof(bound.sun_path), "%s.%d", path, (int) getpid()) >= sizeof(bound.sun_path))){
+		fprintf(stderr, "admin socket path too long: %s\n", path);
+		return -1;
+	}
+	admin_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(admin_fd < 0){
+		perror("admin socket");
+		return -1;
+	}
+	if(replace){
+		unlink(bound.sun_path);
+	}
+	if((bind(admin_fd, (struct sockaddr *) &bound, sizeof(bound)) < 0) || (listen(admin_fd, 4) < 0) ||
+		(replace && (rename(bound.sun_path, path) < 0))){
+		perror("admin bind");
+		if(replace){
+			unlink(bound.sun_path);
+		}
+		close(admin_fd);
+		admin_fd = -1;
+		return -1;
+	}
+	if(pthread_create(&admin_thread, NULL, &aesd_metrics_admin, NULL) != 0){
+		perror("Unable to start the admin thread");
+		close(admin_fd);
+		admin_fd = -1;
+		return -1;
+	}
+	AESD_LOG(LOG_INFO, "Metrics served on %s", path);
+	return 0;
+}
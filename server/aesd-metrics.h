@@ -0,0 +1,96 @@
+/* Name	:	Sricharan Kidambi S
+   File	:	aesd-metrics.h
+   Brief	:	Counters and latency histograms of aesdsocket. Every thread updates its own copy without locks or
+   		atomic read-modify-write instructions, a report sums the copies of all threads.
+*/
+
+#ifndef AESD_METRICS_H
+#define AESD_METRICS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+// Every power of two of a latency is split into 2^AESD_METRICS_SUB_BITS buckets, about 12% relative precision
+#define AESD_METRICS_SUB_BITS 3
+#define AESD_METRICS_BUCKETS ((64 - AESD_METRICS_SUB_BITS + 1) << AESD_METRICS_SUB_BITS)
+
+typedef enum aesd_metrics_counter
+{
+	AESD_METRIC_BYTES_IN,
+	AESD_METRIC_BYTES_OUT,
+	AESD_METRIC_PACKETS,
+	AESD_METRIC_CONNECTIONS_OPENED,
+	AESD_METRIC_CONNECTIONS_CLOSED,
+	AESD_METRIC_POOL_QUEUED,
+	AESD_METRIC_POOL_DEQUEUED,
+	AESD_METRIC_COMMIT_BATCHES,
+	AESD_METRIC_COMMIT_PACKETS,
+	AESD_METRIC_MUTEX_WAIT_NS,
+	AESD_METRIC_SNAPSHOT_HITS,
+	AESD_METRIC_SNAPSHOT_READS,
+	AESD_METRIC_SUBSCRIBERS_OPENED,
+	AESD_METRIC_SUBSCRIBERS_CLOSED,
+	AESD_METRIC_SUBSCRIBE_DROPPED,
+	AESD_METRIC_SUBSCRIBE_DISCONNECTS,
+	AESD_METRIC_LOG_DROPPED,
+	AESD_METRIC_ARENAS_CREATED,
+	AESD_METRIC_ARENAS_RECYCLED,
+	AESD_METRIC_ARENAS_RETURNED,
+	AESD_METRIC_ARENAS_FREED,
+	AESD_METRIC_ARENA_OVERFLOWS,
+	AESD_METRIC_OUTPUT_PAUSES,
+	AESD_METRIC_COUNTERS
+}aesd_metrics_counter_t;
+
+typedef enum aesd_metrics_histogram
+{
+	AESD_METRIC_ACCEPT_TO_FIRST_BYTE,	// connection accepted until its first byte is received
+	AESD_METRIC_RECEIVE,			// first byte of a packet until its '\n' is received
+	AESD_METRIC_STORE_WRITE,		// packet handed to the store until it is written, including lock and batch waits
+	AESD_METRIC_SEND,			// response started until the whole store is sent
+	AESD_METRIC_HISTOGRAMS
+}aesd_metrics_histogram_t;
+
+/* Function	: aesd_metrics_now
+ * Purpose	: CLOCK_MONOTONIC time in nanoseconds, the start time passed to aesd_metrics_record()
+ */
+uint64_t aesd_metrics_now(void);
+
+/* Function	: aesd_metrics_add
+ * Purpose	: add value to a counter of the calling thread
+ */
+void aesd_metrics_add(aesd_metrics_counter_t counter, uint64_t value);
+
+/* Function	: aesd_metrics_total
+ * Purpose	: current sum of a counter over all threads
+ */
+uint64_t aesd_metrics_total(aesd_metrics_counter_t counter);
+
+/* Function	: aesd_metrics_record
+ * Purpose	: record the time elapsed since started (from aesd_metrics_now()) in a histogram of the calling thread
+ */
+void aesd_metrics_record(aesd_metrics_histogram_t histogram, uint64_t started);
+
+/* Function	: aesd_metrics_lock
+ * Purpose	: pthread_mutex_lock() which adds the time spent waiting for the lock to AESD_METRIC_MUTEX_WAIT_NS
+ */
+void aesd_metrics_lock(pthread_mutex_t *lock);
+
+/* Function	: aesd_metrics_report
+ * Purpose	: write the sum of all threads as text, one "name value" line per counter and one line of percentiles
+ *		  in microseconds per histogram
+ * Parameters	: descriptor to write the report to
+ * Returns	: 0 on success, -1 when the report could not be written
+ */
+int aesd_metrics_report(int report_fd);
+
+/* Function	: aesd_metrics_serve
+ * Purpose	: start a thread answering every connection to the unix socket at path with a report. Something at path
+ *		  is only removed when it is a socket nobody listens on anymore, a running server keeps its socket.
+ * Parameters	: the socket path, whether the previous server handed over and its live socket is replaced
+ * Returns	: 0 on success, -1 on failure
+ */
+int aesd_metrics_serve(const char *path, bool replace);
+
+#endif /* AESD_METRICS_H */
@@ -0,0 +1,160 @@
+/* Name	:	Sricharan Kidambi S
+   File	:	aesd-outq.c
+   Brief	:	Output queue of the epoll engine, see aesd-outq.h
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "aesd-outq.h"
+#include "aesd-metrics.h"
+
+// Snapshot segments handed to one sendmsg()
+#define OUTQ_IOV_MAX 16
+
+// Prepare an empty queue, see aesd-outq.h
+void aesd_outq_init(aesd_outq_t *outq)
+{
+	memset(outq, 0, sizeof(aesd_outq_t));
+}
+
+// Drop every segment, see aesd-outq.h
+void aesd_outq_free(aesd_outq_t *outq)
+{
+	for(unsigned i = 0; i < outq->count; i++){
+		aesd_snapshot_put(outq->segments[(outq->head + i) % AESD_OUTQ_SEGMENTS].snapshot);
+	}
+	aesd_outq_init(outq);
+}
+
+// Whether every response is sent, see aesd-outq.h
+bool aesd_outq_empty(const aesd_outq_t *outq)
+{
+	return outq->count == 0;
+}
+
+// Whether the next packet may be taken, see aesd-outq.h
+bool aesd_outq_ready(aesd_outq_t *outq)
+{
+	if(outq->count == AESD_OUTQ_SEGMENTS){
+		return false;
+	}
+	// A stream segment reads the store when it is sent, a later packet must not change what it sends
+	if((outq->count > 0) && !outq->segments[(outq->head + outq->count - 1) % AESD_OUTQ_SEGMENTS].snapshot){
+		return false;
+	}
+	if(outq->paused){
+		if(outq->queued > config.output_low){
+			return false;
+		}
+		outq->paused = false;
+	}
+	else if(outq->queued >= config.output_high){
+		outq->paused = true;
+		aesd_metrics_add(AESD_METRIC_OUTPUT_PAUSES, 1);
+		return false;
+	}
+	return true;
+}
+
+// Queue a response, see aesd-outq.h
+int aesd_outq_push(aesd_outq_t *outq, store_stream_t *stream, aesd_store_t *store)
+{
+	aesd_outq_segment_t *segment = &outq->segments[(outq->head + outq->count) % AESD_OUTQ_SEGMENTS];
+	memset(segment, 0, sizeof(aesd_outq_segment_t));
+	segment->queued_at = aesd_metrics_now();
+	if(config.snapshot_cache && !stream->framed){
+		segment->snapshot = aesd_snapshot_get(store);
+		if(!segment->snapshot){
+			return -1;
+		}
+		segment->end = segment->snapshot->len;
+		if((store->end >= 0) && ((size_t) store->end < segment->end)){
+			segment->end = store->end;
+		}
+		segment->offset = ((size_t) store->pos < segment->end) ? (size_t) store->pos : segment->end;
+		outq->queued += segment->end - segment->offset;
+	}
+	outq->count++;
+	return 0;
+}
+
+/* Function	: aesd_outq_pop
+ * Purpose	: drop the completely sent segment at the head of the queue
+ */
+static void aesd_outq_pop(aesd_outq_t *outq)
+{
+	aesd_outq_segment_t *segment = &outq->segments[outq->head];
+	aesd_metrics_record(AESD_METRIC_SEND, segment->queued_at);
+	aesd_snapshot_put(segment->snapshot);
+	segment->snapshot = NULL;
+	outq->head = (outq->head + 1) % AESD_OUTQ_SEGMENTS;
+	outq->count--;
+}
+
+/* Function	: aesd_outq_send_snapshots
+ * Purpose	: one sendmsg() of the snapshot segments at the head of the queue
+ * Returns	: 1 when something was sent, 0 when the socket is full, -1 on failure
+ */
+static int aesd_outq_send_snapshots(aesd_outq_t *outq, store_stream_t *stream, int clientfd)
+{
+	struct iovec iov[OUTQ_IOV_MAX];
+	int iovcnt = 0;
+	for(unsigned i = 0; (i < outq->count) && (iovcnt < OUTQ_IOV_MAX); i++){
+		aesd_outq_segment_t *segment = &outq->segments[(outq->head + i) % AESD_OUTQ_SEGMENTS];
+		if(!segment->snapshot){
+			break;
+		}
+		iov[iovcnt].iov_base = segment->snapshot->data + segment->offset;
+		iov[iovcnt].iov_len = segment->end - segment->offset;
+		iovcnt++;
+	}
+	struct msghdr msg = { .msg_iov = iov, .msg_iovlen = iovcnt };
+	ssize_t sent;
+	while(((sent = sendmsg(clientfd, &msg, MSG_NOSIGNAL)) < 0) && (errno == EINTR));
+	if(sent < 0){
+		return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -1;
+	}
+	aesd_metrics_add(AESD_METRIC_BYTES_OUT, sent);
+	stream->sent += sent;
+	outq->queued -= sent;
+	for(int i = 0; i < iovcnt; i++){
+		aesd_outq_segment_t *segment = &outq->segments[outq->head];
+		size_t part = ((size_t) sent < iov[i].iov_len) ? (size_t) sent : iov[i].iov_len;
+		segment->offset += part;
+		sent -= part;
+		if(segment->offset < segment->end){
+			break;
+		}
+		aesd_outq_pop(outq);
+	}
+	return 1;
+}
+
+// Send queued responses, see aesd-outq.h
+int aesd_outq_flush(aesd_outq_t *outq, store_stream_t *stream, aesd_store_t *store, int clientfd)
+{
+	while(outq->count > 0){
+		aesd_outq_segment_t *segment = &outq->segments[outq->head];
+		int status;
+		if(segment->snapshot){
+			// An empty window still has to leave the queue
+			if(segment->offset == segment->end){
+				aesd_outq_pop(outq);
+				continue;
+			}
+			status = aesd_outq_send_snapshots(outq, stream, clientfd);
+		}
+		else{
+			status = store_stream_send(stream, store, clientfd);
+			if(status > 0){
+				aesd_outq_pop(outq);
+			}
+		}
+		if(status <= 0){
+			return status;
+		}
+	}
+	return 1;
+}
@@ -0,0 +1,94 @@
+/* Name	:	Sricharan Kidambi S
+   File	:	aesd-outq.h
+   Brief	:	Per connection output queue of the epoll engine. Responses are queued as segments and flushed whenever
+   		the socket is writable, so a client can pipeline packets in a session without waiting for each response.
+   Notes	:	1.	With -C a text response is captured when its packet is applied, as the referenced cached snapshot and
+   				the window of it to send. Any number of such segments go out together with one writev().
+   			2.	Any other response is a stream segment, sent from the store by store_stream_send() when it reaches
+   				the head of the queue. The store is read late, so no packet is taken after a stream segment until
+   				it is sent.
+   			3.	Snapshot bytes waiting in the queue are bounded by watermarks: above the high watermark the
+   				connection stops taking packets (and so stops reading its socket), below the low one it resumes.
+   				Stream segments are not counted, by 2. a connection never queues anything behind one, so -o is
+   				only accepted together with -C.
+*/
+
+#ifndef AESD_OUTQ_H
+#define AESD_OUTQ_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "aesdsocket.h"
+#include "aesd-snapshot.h"
+
+// Responses one connection may have queued
+#define AESD_OUTQ_SEGMENTS 32
+// Watermarks in bytes when -o is not given
+#define AESD_OUTQ_DEFAULT_HIGH (1024 * 1024)
+#define AESD_OUTQ_DEFAULT_LOW (256 * 1024)
+
+typedef struct aesd_outq_segment
+{
+	/**
+	 * Referenced snapshot the response is sent from, NULL for a stream segment
+	 */
+	aesd_snapshot_t *snapshot;
+	/**
+	 * Window of the snapshot still to send
+	 */
+	size_t offset;
+	size_t end;
+	/**
+	 * aesd_metrics_now() when the response was queued
+	 */
+	uint64_t queued_at;
+}aesd_outq_segment_t;
+
+typedef struct aesd_outq
+{
+	aesd_outq_segment_t segments[AESD_OUTQ_SEGMENTS];
+	unsigned head;
+	unsigned count;
+	/**
+	 * Snapshot bytes queued and not sent yet
+	 */
+	size_t queued;
+	/**
+	 * Crossed the high watermark and did not fall below the low one yet
+	 */
+	bool paused;
+}aesd_outq_t;
+
+/* Function	: aesd_outq_init / aesd_outq_free
+ * Purpose	: prepare an empty queue, drop every queued segment
+ */
+void aesd_outq_init(aesd_outq_t *outq);
+void aesd_outq_free(aesd_outq_t *outq);
+
+/* Function	: aesd_outq_ready
+ * Purpose	: whether the connection may take its next packet. Applies the watermarks of config.
+ */
+bool aesd_outq_ready(aesd_outq_t *outq);
+
+/* Function	: aesd_outq_empty
+ * Purpose	: whether every queued response is completely sent
+ */
+bool aesd_outq_empty(const aesd_outq_t *outq);
+
+/* Function	: aesd_outq_push
+ * Purpose	: queue the response to the packet just applied, only when aesd_outq_ready() said so. A snapshot
+ *		  segment is taken when config.snapshot_cache is set and the response is not framed.
+ * Parameters	: the queue, the connection's stream state and store handle (store->pos and store->end are the window)
+ * Returns	: 0 on success, -1 when the snapshot could not be taken
+ */
+int aesd_outq_push(aesd_outq_t *outq, store_stream_t *stream, aesd_store_t *store);
+
+/* Function	: aesd_outq_flush
+ * Purpose	: send queued responses until the queue is empty or the socket is full
+ * Parameters	: the queue, the connection's stream state and store handle, the non-blocking client socket
+ * Returns	: 1 when the queue is empty, 0 when the socket is full, -1 on failure
+ */
+int aesd_outq_flush(aesd_outq_t *outq, store_stream_t *stream, aesd_store_t *store, int clientfd);
+
+#endif /* AESD_OUTQ_H */
@@ -0,0 +1,148 @@
+/* Name	:	Sricharan Kidambi S
+   File	:	aesd-pool.c
+   Brief	:	Worker pool and bounded connection queue for the thread engine of aesdsocket
+   References	:	https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue - Dmitry Vyukov's bounded queue
+   Notes	:	1.	The queue is an array of cells, each tagged with a sequence number telling whether it is free for
+   				the producer of a given position or filled for the consumer of that position. Producers and consumers
+   				only share two atomic counters, no lock is taken to move a connection.
+   			2.	Two counting semaphores give the blocking behaviour: free_slots makes the acceptor wait while the
+   				queue is full, queued makes idle workers sleep while it is empty.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include "aesd-pool.h"
+#include "aesd-metrics.h"
+
+typedef struct aesd_pool_cell
+{
+	atomic_size_t sequence;
+	aesd_client_t client;
+}aesd_pool_cell_t;
+
+struct aesd_pool
+{
+	aesd_pool_cell_t *cells;
+	size_t depth;
+	atomic_size_t enqueue_pos;
+	atomic_size_t dequeue_pos;
+	sem_t free_slots;
+	sem_t queued;
+	aesd_pool_handler_t handler;
+	int workers;
+	pthread_t *threads;
+};
+
+/* Function	: aesd_pool_wait
+ * Purpose	: sem_wait which is not cut short by a signal
+ */
+static void aesd_pool_wait(sem_t *sem)
+{
+	while((sem_wait(sem) < 0) && (errno == EINTR));
+}
+
+/* Function	: aesd_pool_dequeue
+ * Purpose	: take the oldest connection from the queue, the caller already consumed one count of pool->queued
+ */
+static void aesd_pool_dequeue(aesd_pool_t *pool, aesd_client_t *client)
+{
+	size_t pos = atomic_fetch_add(&pool->dequeue_pos, 1);
+	aesd_pool_cell_t *cell = &pool->cells[pos % pool->depth];
+	// The count says the item exists, its producer may still be copying it in
+	while(atomic_load_explicit(&cell->sequence, memory_order_acquire) != pos + 1){
+		sched_yield();
+	}
+	*client = cell->client;
+	atomic_store_explicit(&cell->sequence, pos + pool->depth, memory_order_release);
+	sem_post(&pool->free_slots);
+	aesd_metrics_add(AESD_METRIC_POOL_DEQUEUED, 1);
+}
+
+/* Function	: aesd_pool_worker
+ * Purpose	: body of every worker thread, serve queued connections forever
+ */
+static void *aesd_pool_worker(void *thread_param)
+{
+	aesd_pool_t *pool = (aesd_pool_t *) thread_param;
+	aesd_client_t client;
+	while(1){
+		aesd_pool_wait(&pool->queued);
+		aesd_pool_dequeue(pool, &client);
+		pool->handler(&client);
+	}
+	return thread_param;
+}
+
+// Create the pool and start its workers, see aesd-pool.h
+aesd_pool_t *aesd_pool_create(int workers, int depth, aesd_pool_handler_t handler)
+{
+	aesd_pool_t *pool = (aesd_pool_t *) calloc(1, sizeof(aesd_pool_t));
+	if(!pool){
+		return NULL;
+	}
+	pool->depth = depth;
+	pool->handler = handler;
+	pool->cells = (aesd_pool_cell_t *) calloc(depth, sizeof(aesd_pool_cell_t));
+	pool->threads = (pthread_t *) calloc(workers, sizeof(pthread_t));
+	if(!pool->cells || !pool->threads){
+		free(pool->cells);
+		free(pool->threads);
+		free(pool);
+		return NULL;
+	}
+	for(size_t i = 0; i < pool->depth; i++){
+		atomic_init(&pool->cells[i].sequence, i);
+	}
+	atomic_init(&pool->enqueue_pos, 0);
+	atomic_init(&pool->dequeue_pos, 0);
+	sem_init(&pool->free_slots, 0, depth);
+	sem_init(&pool->queued, 0, 0);
+	for(pool->workers = 0; pool->workers < workers; pool->workers++){
+		if(pthread_create(&pool->threads[pool->workers], NULL, &aesd_pool_worker, pool) != 0){
+			perror("Unable to start worker thread");
+			break;
+		}
+	}
+	// A partially started pool still serves, just with fewer workers
+	if(pool->workers == 0){
+		sem_destroy(&pool->free_slots);
+		sem_destroy(&pool->queued);
+		free(pool->cells);
+		free(pool->threads);
+		free(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+// Wait for room in the queue, see aesd-pool.h
+void aesd_pool_reserve(aesd_pool_t *pool)
+{
+	aesd_pool_wait(&pool->free_slots);
+}
+
+// Hand back an unused reservation, see aesd-pool.h
+void aesd_pool_unreserve(aesd_pool_t *pool)
+{
+	sem_post(&pool->free_slots);
+}
+
+// Queue an accepted connection, see aesd-pool.h
+void aesd_pool_submit(aesd_pool_t *pool, const aesd_client_t *client)
+{
+	size_t pos = atomic_fetch_add(&pool->enqueue_pos, 1);
+	aesd_pool_cell_t *cell = &pool->cells[pos % pool->depth];
+	// The reservation guarantees the slot, its last consumer may still be copying out of it
+	while(atomic_load_explicit(&cell->sequence, memory_order_acquire) != pos){
+		sched_yield();
+	}
+	cell->client = *client;
+	atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+	aesd_metrics_add(AESD_METRIC_POOL_QUEUED, 1);
+	sem_post(&pool->queued);
+}
@@ -0,0 +1,52 @@
+/* Name	:	Sricharan Kidambi S
+   File	:	aesd-pool.h
+   Brief	:	Fixed size worker thread pool fed by a bounded connection queue, used by the thread engine of aesdsocket
+*/
+
+#ifndef AESD_POOL_H
+#define AESD_POOL_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+// Defaults used when -w / -q are not given on the command line
+#define AESD_POOL_DEFAULT_WORKERS 8
+#define AESD_POOL_DEFAULT_DEPTH 64
+
+// One accepted connection waiting for a worker
+typedef struct aesd_client
+{
+	int clientfd;
+	char client_ipaddress[INET6_ADDRSTRLEN];
+	uint64_t accepted_at;		// aesd_metrics_now() of the accept
+}aesd_client_t;
+
+// Called on a worker thread for every dequeued connection, the handler owns and closes client->clientfd
+typedef void (*aesd_pool_handler_t)(aesd_client_t *client);
+
+typedef struct aesd_pool aesd_pool_t;
+
+/* Function	: aesd_pool_create
+ * Purpose	: allocate the connection queue and start the worker threads
+ * Parameters	: number of workers, queue depth, handler run for every connection
+ * Returns	: the pool, or NULL on failure
+ */
+aesd_pool_t *aesd_pool_create(int workers, int depth, aesd_pool_handler_t handler);
+
+/* Function	: aesd_pool_reserve
+ * Purpose	: wait until the queue has room for one more connection. The acceptor calls this before accept(), so a
+ *		  full queue leaves new connections in the kernel backlog instead of spawning anything.
+ */
+void aesd_pool_reserve(aesd_pool_t *pool);
+
+/* Function	: aesd_pool_unreserve
+ * Purpose	: give back a reservation which was not used because accept() failed
+ */
+void aesd_pool_unreserve(aesd_pool_t *pool);
+
+/* Function	: aesd_pool_submit
+ * Purpose	: queue an accepted connection into a slot taken with aesd_pool_reserve(), never blocks
+ */
+void aesd_pool_submit(aesd_pool_t *pool, const aesd_client_t *client);
+
+#endif /* AESD_POOL_H */
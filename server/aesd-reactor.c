@@ -0,0 +1,538 @@
+/* Name	:	Sricharan Kidambi S
+   File	:	aesd-reactor.c
+   Brief	:	epoll based connection engine for aesdsocket. A small fixed number of event loop threads multiplex
+   		all client sockets instead of spawning one thread per accept().
+   References	:	https://man7.org/linux/man-pages/man7/epoll.7.html - edge triggered usage and EAGAIN handling
+   			https://man7.org/linux/man-pages/man2/epoll_ctl.2.html - EPOLLEXCLUSIVE to avoid thundering herd on accept
+   Notes	:	1.	Every event loop owns one epoll instance. The listening socket is registered in all of them with
+   				EPOLLEXCLUSIVE, so the kernel wakes one loop per incoming connection and that loop keeps the client
+   				for its whole lifetime. No connection state is ever shared between loops. With several SO_REUSEPORT
+   				listeners (-l) each loop only watches its own listener and the kernel does the spreading.
+   			2.	Client sockets are non-blocking and registered once for EPOLLIN and EPOLLOUT, edge triggered.
+   				Every notification flushes the output queue and then reads until EAGAIN, or until the queue is
+   				too full to take another packet, in which case the next EPOLLOUT continues reading.
+   			3.	The line protocol is the one of the thread engine: read up to '\n', apply the packet with
+   				store_packet() (which also handles AESDCHAR_IOCSEEKTO:X,Y), queue the response from the file
+   				position left by store_packet() on the connection's output queue (aesd-outq.h) and close the
+   				connection once it is sent. With -s the connection instead keeps taking packets while its queue
+   				stays below the -o watermarks, a client pipelining packets gets its responses as the socket drains.
+   				AESDCHAR_SUBSCRIBE hands the connection over to the subscription thread (aesd-subscribe.c) once
+   				its queue is empty. A connection starting with AESD_FRAME_MAGIC sends aesd-frame.h frames instead
+   				of lines and gets framed responses.
+   			4.	Every loop keeps its connections in least recently active order, the idle sweep only looks at
+   				the head of that list.
+   			5.	With group commit (-g) a packet is handed to the committer and the connection waits without
+   				blocking its loop. The committer queues the connection on the loop's completed list and signals the
+   				loop's eventfd, the loop then sends the response.
+   			6.	A drain (aesd-drain.c) is seen as the drain eventfd becoming readable, the loop drops the listener
+   				from its epoll set and goes on serving the connections it has.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/queue.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "aesdsocket.h"
+#include "aesd-rxbuf.h"
+#include "aesd-commit.h"
+#include "aesd-metrics.h"
+#include "aesd-subscribe.h"
+#include "aesd-log.h"
+#include "aesd-outq.h"
+#include "aesd-drain.h"
+
+#define REACTOR_MAX_EVENTS	64
+// How often idle sessions are looked for, in milliseconds
+#define REACTOR_SWEEP_INTERVAL	1000
+
+struct reactor;
+
+// State of one client connection, only ever touched by the event loop that accepted it
+typedef struct reactor_conn
+{
+	struct reactor *reactor;
+	aesd_arena_t *arena;		// holds this structure and the buffers of the connection
+	int clientfd;
+	aesd_store_t store;
+	char client_ipaddress[INET6_ADDRSTRLEN];
+	aesd_rxbuf_t rx;		// bytes of the packet received so far
+	store_stream_t stream;		// state of the stream segment of the output queue
+	aesd_outq_t outq;		// responses not completely sent yet
+	bool closing;			// no packet is taken anymore, the connection closes once its queue is empty
+	bool subscribe_pending;		// sent AESDCHAR_SUBSCRIBE, handed over once its queue is empty
+	bool committing;		// packet handed to the committer, nothing else happens until it is written
+	aesd_commit_req_t commit;
+	struct reactor_conn *next_committed;
+	time_t last_active;		// CLOCK_MONOTONIC seconds of the last received packet or sent response bytes
+	TAILQ_ENTRY(reactor_conn) entries;
+}reactor_conn_t;
+
+typedef struct reactor
+{
+	pthread_t thread;
+	int epfd;
+	int sockfd;
+	TAILQ_HEAD(reactor_conn_head, reactor_conn) conns;
+	/**
+	 * Connections whose packet the committer has written, filled by the committer thread
+	 */
+	pthread_mutex_t committed_lock;
+	reactor_conn_t *committed;
+	int wakeup_fd;
+	/**
+	 * The listener is out of the epoll set, a drain started
+	 */
+	bool drained;
+}reactor_t;
+
+// epoll user data of the wakeup and drain eventfds, the listener uses NULL and connections their reactor_conn_t
+static int reactor_wakeup_tag;
+static int reactor_drain_tag;
+
+static void reactor_commit_done(aesd_commit_req_t *req);
+
+/* Function	: reactor_now
+ * Purpose	: monotonic time in seconds, used for the session idle timeout
+ */
+static time_t reactor_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec;
+}
+
+/* Function	: reactor_touch
+ * Purpose	: mark a connection as active, moving it to the tail of the idle order
+ */
+static void reactor_touch(reactor_t *reactor, reactor_conn_t *conn)
+{
+	conn->last_active = reactor_now();
+	TAILQ_REMOVE(&reactor->conns, conn, entries);
+	TAILQ_INSERT_TAIL(&reactor->conns, conn, entries);
+}
+
+/* Function	: reactor_release_conn
+ * Purpose	: release everything owned by a connection except its socket
+ */
+static void reactor_release_conn(reactor_t *reactor, reactor_conn_t *conn)
+{
+	TAILQ_REMOVE(&reactor->conns, conn, entries);
+	close_store(&conn->store);
+	aesd_rxbuf_free(&conn->rx);
+	store_stream_free(&conn->stream);
+	aesd_outq_free(&conn->outq);
+	aesd_arena_put(conn->arena);
+}
+
+/* Function	: reactor_close_conn
+ * Purpose	: release everything owned by a connection, closing the socket also drops it from the epoll set
+ */
+static void reactor_close_conn(reactor_t *reactor, reactor_conn_t *conn)
+{
+	aesd_metrics_add(AESD_METRIC_CONNECTIONS_CLOSED, 1);
+	if(close(conn->clientfd) == 0){
+		AESD_LOG(LOG_DEBUG, "Closed connection from %s", conn->client_ipaddress);
+	}
+	reactor_release_conn(reactor, conn);
+}
+
+/* Function	: reactor_subscribe
+ * Purpose	: hand a connection which sent AESDCHAR_SUBSCRIBE over to the subscription thread
+ */
+static void reactor_subscribe(reactor_t *reactor, reactor_conn_t *conn)
+{
+	if((epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, conn->clientfd, NULL) < 0) ||
+		(aesd_subscribe_add(conn->clientfd, conn->client_ipaddress) < 0)){
+		reactor_close_conn(reactor, conn);
+		return;
+	}
+	reactor_release_conn(reactor, conn);
+}
+
+/* Function	: reactor_accept
+ * Purpose	: accept every pending connection on the listening socket and register it with this event loop
+ * Parameters	: the event loop which got the EPOLLIN notification for the listener
+ */
+static void reactor_accept(reactor_t *reactor)
+{
+	// An event of the listener reported together with the drain
+	while(!reactor->drained){
+		struct sockaddr_in clientadd;
+		socklen_t clientlen = sizeof(clientadd);
+		int clientfd = accept4(reactor->sockfd, (struct sockaddr *) &clientadd, &clientlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(clientfd < 0){
+			// Another loop may have taken the connection, or the backlog is simply drained
+			if((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)){
+				perror("Error in accepting\n");
+			}
+			return;
+		}
+		aesd_arena_t *arena = aesd_arena_get();
+		reactor_conn_t *conn = arena ? (reactor_conn_t *) aesd_arena_alloc(arena, sizeof(reactor_conn_t)) : NULL;
+		if(!conn){
+			aesd_arena_put(arena);
+			close(clientfd);
+			continue;
+		}
+		memset(conn, 0, sizeof(reactor_conn_t));
+		conn->arena = arena;
+		conn->clientfd = clientfd;
+		conn->reactor = reactor;
+		conn->last_active = reactor_now();
+		TAILQ_INSERT_TAIL(&reactor->conns, conn, entries);
+		aesd_metrics_add(AESD_METRIC_CONNECTIONS_OPENED, 1);
+		aesd_rxbuf_init(&conn->rx);
+		conn->rx.accepted_at = aesd_metrics_now();
+		conn->rx.arena = arena;
+		store_stream_init(&conn->stream);
+		conn->stream.arena = arena;
+		aesd_outq_init(&conn->outq);
+		int store_status = open_store(&conn->store);
+		inet_ntop(AF_INET, &clientadd.sin_addr, conn->client_ipaddress, sizeof(conn->client_ipaddress));
+		AESD_LOG(LOG_DEBUG, "Accepted a connection from %s", conn->client_ipaddress);
+		if(store_status < 0){
+			reactor_close_conn(reactor, conn);
+			continue;
+		}
+		struct epoll_event event = {0};
+		event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		event.data.ptr = conn;
+		if(epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, clientfd, &event) < 0){
+			perror("epoll_ctl add client");
+			reactor_close_conn(reactor, conn);
+			continue;
+		}
+	}
+}
+
+/* Function	: reactor_receive
+ * Purpose	: drain the socket into the receive buffer until EAGAIN or until a complete packet is buffered
+ * Parameters	: the connection, returned packet and its length
+ * Returns	: 1 when a complete packet is returned, 0 when more data is needed or the peer sent everything (closing
+ *		  is set then), -1 on failure
+ */
+static int reactor_receive(reactor_conn_t *conn, const char **packet, size_t *packet_bytes)
+{
+	while(!aesd_rxbuf_next_packet(&conn->rx, packet, packet_bytes)){
+		ssize_t receive_bytes = aesd_rxbuf_recv(&conn->rx, conn->clientfd);
+		if(receive_bytes < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			if((errno == EAGAIN) || (errno == EWOULDBLOCK)){
+				return 0;
+			}
+			perror("recv error\n");
+			return -1;
+		}
+		if(receive_bytes == 0){
+			// Peer finished sending, a packet it did not complete is dropped but queued responses still go out
+			conn->closing = true;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Function	: reactor_respond
+ * Purpose	: queue the response to a packet which was just applied to the store and send what the socket accepts
+ * Returns	: true when the connection may go on, false when it was closed
+ */
+static bool reactor_respond(reactor_t *reactor, reactor_conn_t *conn)
+{
+	if((aesd_outq_push(&conn->outq, &conn->stream, &conn->store) < 0) ||
+		(aesd_outq_flush(&conn->outq, &conn->stream, &conn->store, conn->clientfd) < 0)){
+		reactor_close_conn(reactor, conn);
+		return false;
+	}
+	//Once the packet is transmitted, close the socket unless the client keeps a session
+	if(config.session_timeout == 0){
+		conn->closing = true;
+	}
+	return true;
+}
+
+/* Function	: reactor_process
+ * Purpose	: take packets one after the other while the output queue has room for their responses, then close or
+ *		  hand over the connection if it is done and its queue is empty
+ */
+static void reactor_process(reactor_t *reactor, reactor_conn_t *conn)
+{
+	const char *packet;
+	size_t packet_bytes;
+	while(!conn->closing && !conn->subscribe_pending && aesd_outq_ready(&conn->outq)){
+		int status = reactor_receive(conn, &packet, &packet_bytes);
+		if(status == 0){
+			break;
+		}
+		if(status < 0){
+			reactor_close_conn(reactor, conn);
+			return;
+		}
+		reactor_touch(reactor, conn);
+		conn->stream.framed = (conn->rx.framing == AESD_FRAMING_BINARY);
+		if((conn->rx.opcode == AESD_OP_TEXT) && aesd_subscribe_command(packet, packet_bytes)){
+			conn->subscribe_pending = true;
+			break;
+		}
+		if(config.group_commit){
+			status = store_seek(&conn->store, conn->rx.opcode, packet, packet_bytes);
+			if(status == 0){
+				// The packet stays in the receive buffer until the committer wrote it
+				conn->commit.packet = packet;
+				conn->commit.len = packet_bytes;
+				conn->commit.done = &reactor_commit_done;
+				conn->commit.owner = conn;
+				conn->committing = true;
+				aesd_commit_submit(&conn->commit);
+				return;
+			}
+		}
+		else{
+			status = store_packet(&conn->store, conn->rx.opcode, packet, packet_bytes);
+		}
+		if(status < 0){
+			reactor_close_conn(reactor, conn);
+			return;
+		}
+		if(!reactor_respond(reactor, conn)){
+			return;
+		}
+	}
+	if(!aesd_outq_empty(&conn->outq)){
+		// The next EPOLLOUT flushes the queue and comes back here
+		return;
+	}
+	if(conn->subscribe_pending){
+		reactor_subscribe(reactor, conn);
+	}
+	else if(conn->closing){
+		reactor_close_conn(reactor, conn);
+	}
+}
+
+/* Function	: reactor_handle
+ * Purpose	: react to readiness of one client socket
+ */
+static void reactor_handle(reactor_t *reactor, reactor_conn_t *conn, uint32_t events)
+{
+	if(conn->committing){
+		// Whatever happened to the socket is looked at once the packet is written
+		return;
+	}
+	uint64_t sent = conn->stream.sent;
+	if((events & (EPOLLERR | EPOLLHUP)) ||
+		(aesd_outq_flush(&conn->outq, &conn->stream, &conn->store, conn->clientfd) < 0)){
+		reactor_close_conn(reactor, conn);
+		return;
+	}
+	if(conn->stream.sent != sent){
+		// A client reading a large response is not idle
+		reactor_touch(reactor, conn);
+	}
+	reactor_process(reactor, conn);
+}
+
+/* Function	: reactor_commit_done
+ * Purpose	: completion callback of the committer, runs on the committer thread and hands the connection back to
+ *		  its event loop
+ */
+static void reactor_commit_done(aesd_commit_req_t *req)
+{
+	reactor_conn_t *conn = (reactor_conn_t *) req->owner;
+	reactor_t *reactor = conn->reactor;
+	pthread_mutex_lock(&reactor->committed_lock);
+	conn->next_committed = reactor->committed;
+	reactor->committed = conn;
+	pthread_mutex_unlock(&reactor->committed_lock);
+	eventfd_write(reactor->wakeup_fd, 1);
+}
+
+/* Function	: reactor_committed
+ * Purpose	: continue every connection whose packet the committer has written
+ */
+static void reactor_committed(reactor_t *reactor)
+{
+	eventfd_t count;
+	eventfd_read(reactor->wakeup_fd, &count);
+	pthread_mutex_lock(&reactor->committed_lock);
+	reactor_conn_t *conn = reactor->committed;
+	reactor->committed = NULL;
+	pthread_mutex_unlock(&reactor->committed_lock);
+	while(conn){
+		reactor_conn_t *next = conn->next_committed;
+		conn->committing = false;
+		if(conn->commit.status < 0){
+			reactor_close_conn(reactor, conn);
+		}
+		else{
+			// The whole store is sent back after a write, same as store_packet()
+			conn->store.pos = 0;
+			if(reactor_respond(reactor, conn)){
+				reactor_process(reactor, conn);
+			}
+		}
+		conn = next;
+	}
+}
+
+/* Function	: reactor_drain
+ * Purpose	: stop accepting once a drain started, connections already accepted are served to the end
+ */
+static void reactor_drain(reactor_t *reactor)
+{
+	epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, reactor->sockfd, NULL);
+	epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, aesd_drain_fd(), NULL);
+	reactor->drained = true;
+	aesd_drain_leave();
+}
+
+/* Function	: reactor_sweep
+ * Purpose	: close sessions which neither sent a packet nor read response bytes for config.session_timeout seconds
+ */
+static void reactor_sweep(reactor_t *reactor)
+{
+	time_t oldest = reactor_now() - config.session_timeout;
+	reactor_conn_t *conn;
+	while(((conn = TAILQ_FIRST(&reactor->conns)) != NULL) && (conn->last_active <= oldest)){
+		if(conn->committing){
+			// Busy, not idle: it can only be closed once the committer gave it back
+			reactor_touch(reactor, conn);
+			continue;
+		}
+		if(!aesd_outq_empty(&conn->outq)){
+			// Responses are still owed, the session only counts as idle once they are out
+			reactor_touch(reactor, conn);
+			continue;
+		}
+		AESD_LOG(LOG_DEBUG, "Idle session from %s timed out", conn->client_ipaddress);
+		reactor_close_conn(reactor, conn);
+	}
+}
+
+/* Function	: reactor_loop
+ * Purpose	: body of one event loop thread
+ */
+static void *reactor_loop(void *thread_param)
+{
+	reactor_t *reactor = (reactor_t *) thread_param;
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+	int timeout = (config.session_timeout > 0) ? REACTOR_SWEEP_INTERVAL : -1;
+	while(1){
+		int ready = epoll_wait(reactor->epfd, events, REACTOR_MAX_EVENTS, timeout);
+		if(ready < 0){
+			// Only a stray signal interrupts the wait, timestamps come from the timer thread
+			if(errno == EINTR){
+				continue;
+			}
+			perror("epoll_wait");
+			break;
+		}
+		bool woken = false;
+		for(int i = 0; i < ready; i++){
+			if(events[i].data.ptr == NULL){
+				reactor_accept(reactor);
+			}
+			else if(events[i].data.ptr == &reactor_wakeup_tag){
+				// Handled last, it may close connections which still have an event in this batch
+				woken = true;
+			}
+			else if(events[i].data.ptr == &reactor_drain_tag){
+				reactor_drain(reactor);
+			}
+			else{
+				reactor_handle(reactor, (reactor_conn_t *) events[i].data.ptr, events[i].events);
+			}
+		}
+		if(woken){
+			reactor_committed(reactor);
+		}
+		if(config.session_timeout > 0){
+			reactor_sweep(reactor);
+		}
+	}
+	return thread_param;
+}
+
+// Start the epoll event loops, see aesdsocket.h
+int aesd_reactor_run(const int *sockfds, int nlisteners, int nthreads)
+{
+	for(int i = 0; i < nlisteners; i++){
+		int flags = fcntl(sockfds[i], F_GETFL, 0);
+		if((flags < 0) || (fcntl(sockfds[i], F_SETFL, flags | O_NONBLOCK) < 0)){
+			perror("Unable to make the listening socket non-blocking");
+			return -1;
+		}
+	}
+	reactor_t *reactors = (reactor_t *) calloc(nthreads, sizeof(reactor_t));
+	if(!reactors){
+		return -1;
+	}
+	int started = 0;
+	for(int i = 0; i < nthreads; i++){
+		reactors[i].sockfd = sockfds[i % nlisteners];
+		TAILQ_INIT(&reactors[i].conns);
+		pthread_mutex_init(&reactors[i].committed_lock, NULL);
+		reactors[i].epfd = epoll_create1(EPOLL_CLOEXEC);
+		if(reactors[i].epfd < 0){
+			perror("epoll_create1");
+			break;
+		}
+		reactors[i].wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		struct epoll_event wakeup = {0};
+		wakeup.events = EPOLLIN;
+		wakeup.data.ptr = &reactor_wakeup_tag;
+		if((reactors[i].wakeup_fd < 0) || (epoll_ctl(reactors[i].epfd, EPOLL_CTL_ADD, reactors[i].wakeup_fd, &wakeup) < 0)){
+			perror("eventfd");
+			if(reactors[i].wakeup_fd >= 0){
+				close(reactors[i].wakeup_fd);
+			}
+			close(reactors[i].epfd);
+			break;
+		}
+		// The listener is level triggered, a loop which loses the accept() race just sees EAGAIN
+		struct epoll_event event = {0};
+		event.events = EPOLLIN | EPOLLEXCLUSIVE;
+		event.data.ptr = NULL;
+		struct epoll_event drain = {0};
+		drain.events = EPOLLIN;
+		drain.data.ptr = &reactor_drain_tag;
+		if((epoll_ctl(reactors[i].epfd, EPOLL_CTL_ADD, reactors[i].sockfd, &event) < 0) ||
+			(epoll_ctl(reactors[i].epfd, EPOLL_CTL_ADD, aesd_drain_fd(), &drain) < 0)){
+			perror("epoll_ctl add listener");
+			close(reactors[i].wakeup_fd);
+			close(reactors[i].epfd);
+			break;
+		}
+		aesd_drain_join();
+		if(pthread_create(&reactors[i].thread, NULL, &reactor_loop, &reactors[i]) != 0){
+			perror("pthread_create");
+			aesd_drain_leave();
+			close(reactors[i].wakeup_fd);
+			close(reactors[i].epfd);
+			break;
+		}
+		aesd_set_affinity(reactors[i].thread, i);
+		started++;
+	}
+	for(int i = 0; i < started; i++){
+		pthread_join(reactors[i].thread, NULL);
+		close(reactors[i].wakeup_fd);
+		close(reactors[i].epfd);
+	}
+	free(reactors);
+	return -1;
+}
@@ -0,0 +1,210 @@
+/* Name	:	Sricharan Kidambi S
+   File	:	aesd-rxbuf.c
+   Brief	:	Chunked receive path for aesdsocket, replaces the recv of one byte followed by a realloc of one byte.
+   Notes	:	1.	Each recv asks for all the free space in the buffer, a 64 KB packet costs a handful of syscalls.
+   			2.	When the buffer is full it doubles, so the number of reallocations is logarithmic in the packet size.
+   			3.	The terminator is located with memchr(), which glibc implements with vector instructions, and
+   				only over bytes which were not scanned on a previous call.
+   			4.	With an arena the buffer is bumped out of the connection's arena and grows in place while it is the
+   				arena's last allocation. Only a packet too large for the arena moves to malloc().
+   			5.	A binary frame is never scanned. Once its header is in, the buffer keeps doubling as the payload
+   				arrives but never beyond the frame, so a header announcing a large frame does not reserve memory
+   				the peer never sends.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include "aesd-rxbuf.h"
+#include "aesd-frame.h"
+#include "aesd-metrics.h"
+
+// Initialize an empty receive buffer, see aesd-rxbuf.h
+void aesd_rxbuf_init(aesd_rxbuf_t *rx)
+{
+	memset(rx, 0, sizeof(aesd_rxbuf_t));
+}
+
+// Release the receive buffer, see aesd-rxbuf.h
+void aesd_rxbuf_free(aesd_rxbuf_t *rx)
+{
+	if(!aesd_arena_owns(rx->arena, rx->data)){
+		free(rx->data);
+	}
+	aesd_rxbuf_init(rx);
+}
+
+/* Function	: aesd_rxbuf_reserve
+ * Purpose	: make sure there is free space after rx->end. Bytes of already returned packets are dropped first, the
+ *		  capacity is only doubled when the pending packet itself fills the buffer, and not past the end of the
+ *		  frame being received.
+ * Returns	: 0 on success, -1 when memory could not be allocated
+ */
+static int aesd_rxbuf_reserve(aesd_rxbuf_t *rx)
+{
+	if(rx->end < rx->capacity){
+		return 0;
+	}
+	if(rx->start > 0){
+		memmove(rx->data, rx->data + rx->start, rx->end - rx->start);
+		rx->end -= rx->start;
+		rx->start = 0;
+		if(rx->end < rx->capacity){
+			return 0;
+		}
+	}
+	size_t capacity = rx->capacity ? rx->capacity * 2 : AESD_RXBUF_INITIAL_SIZE;
+	if((rx->frame_size > rx->end) && (capacity > rx->frame_size)){
+		capacity = rx->frame_size;
+	}
+	char *grown;
+	if(rx->arena && (!rx->data || aesd_arena_owns(rx->arena, rx->data))){
+		// Everything pending starts at 0 after the compaction above
+		grown = aesd_arena_grow(rx->arena, rx->data, rx->end, capacity);
+		if(!grown){
+			aesd_arena_overflow();
+			grown = malloc(capacity);
+			if(grown && rx->data){
+				memcpy(grown, rx->data, rx->end);
+				// Leave the room to the bounce buffer
+				aesd_arena_free(rx->arena, rx->data);
+			}
+		}
+	}
+	else{
+		grown = realloc(rx->data, capacity);
+	}
+	if(!grown){
+		errno = ENOMEM;
+		return -1;
+	}
+	rx->data = grown;
+	rx->capacity = capacity;
+	return 0;
+}
+
+// Free space at the end of the buffer, see aesd-rxbuf.h
+char *aesd_rxbuf_space(aesd_rxbuf_t *rx, size_t *len)
+{
+	if(aesd_rxbuf_reserve(rx) < 0){
+		return NULL;
+	}
+	*len = rx->capacity - rx->end;
+	return rx->data + rx->end;
+}
+
+// Account for bytes stored into the free space, see aesd-rxbuf.h
+void aesd_rxbuf_commit(aesd_rxbuf_t *rx, size_t len)
+{
+	if(len == 0){
+		return;
+	}
+	aesd_metrics_add(AESD_METRIC_BYTES_IN, len);
+	if(rx->accepted_at){
+		aesd_metrics_record(AESD_METRIC_ACCEPT_TO_FIRST_BYTE, rx->accepted_at);
+		rx->accepted_at = 0;
+	}
+	if(rx->start == rx->end){
+		rx->packet_started = aesd_metrics_now();
+	}
+	rx->end += len;
+}
+
+// Receive the next chunk from the socket, see aesd-rxbuf.h
+ssize_t aesd_rxbuf_recv(aesd_rxbuf_t *rx, int sockfd)
+{
+	size_t space;
+	char *tail = aesd_rxbuf_space(rx, &space);
+	if(!tail){
+		return -1;
+	}
+	ssize_t receive_bytes = recv(sockfd, tail, space, 0);
+	if(receive_bytes > 0){
+		aesd_rxbuf_commit(rx, receive_bytes);
+	}
+	return receive_bytes;
+}
+
+/* Function	: aesd_rxbuf_consume
+ * Purpose	: drop a returned packet of len bytes from the front of the buffer and account for it
+ */
+static void aesd_rxbuf_consume(aesd_rxbuf_t *rx, size_t len)
+{
+	rx->start += len;
+	rx->scanned = 0;
+	aesd_metrics_add(AESD_METRIC_PACKETS, 1);
+	aesd_metrics_record(AESD_METRIC_RECEIVE, rx->packet_started);
+	if(rx->start == rx->end){
+		rx->start = 0;
+		rx->end = 0;
+	}
+	else{
+		// The rest of the buffer arrived together with this packet, the next one starts now
+		rx->packet_started = aesd_metrics_now();
+	}
+}
+
+/* Function	: aesd_rxbuf_next_frame
+ * Purpose	: aesd_rxbuf_next_packet() of a binary connection
+ */
+static bool aesd_rxbuf_next_frame(aesd_rxbuf_t *rx, const char **packet, size_t *len)
+{
+	const char *header = rx->data + rx->start;
+	size_t pending = rx->end - rx->start;
+	if(pending < AESD_FRAME_HEADER_SIZE){
+		return false;
+	}
+	uint32_t length = aesd_frame_u32(header + 4);
+	if(((uint8_t) header[0] != AESD_FRAME_MAGIC) || (length > AESD_FRAME_MAX_PAYLOAD)){
+		// Nothing after a broken header can be trusted, the caller closes the connection
+		rx->opcode = AESD_OP_INVALID;
+		*packet = header;
+		*len = AESD_FRAME_HEADER_SIZE;
+		rx->frame_size = 0;
+		aesd_rxbuf_consume(rx, AESD_FRAME_HEADER_SIZE);
+		return true;
+	}
+	if(pending < AESD_FRAME_HEADER_SIZE + length){
+		rx->frame_size = AESD_FRAME_HEADER_SIZE + length;
+		return false;
+	}
+	rx->opcode = (uint8_t) header[1];
+	*packet = header + AESD_FRAME_HEADER_SIZE;
+	*len = length;
+	rx->frame_size = 0;
+	aesd_rxbuf_consume(rx, AESD_FRAME_HEADER_SIZE + length);
+	return true;
+}
+
+// Return the next complete packet, see aesd-rxbuf.h
+bool aesd_rxbuf_next_packet(aesd_rxbuf_t *rx, const char **packet, size_t *len)
+{
+	if(rx->framing == AESD_FRAMING_UNKNOWN){
+		if(rx->end == rx->start){
+			return false;
+		}
+		rx->framing = ((uint8_t) rx->data[rx->start] == AESD_FRAME_MAGIC) ? AESD_FRAMING_BINARY : AESD_FRAMING_TEXT;
+		rx->opcode = AESD_OP_TEXT;
+	}
+	if(rx->framing == AESD_FRAMING_BINARY){
+		return aesd_rxbuf_next_frame(rx, packet, len);
+	}
+	char *scan_from = rx->data + rx->start + rx->scanned;
+	size_t unscanned = rx->end - rx->start - rx->scanned;
+	char *newline = unscanned ? memchr(scan_from, '\n', unscanned) : NULL;
+	if(!newline){
+		rx->scanned += unscanned;
+		return false;
+	}
+	*packet = rx->data + rx->start;
+	*len = (size_t)(newline - *packet) + 1;
+	aesd_rxbuf_consume(rx, *len);
+	return true;
+}
+
+// Bytes received past the last returned packet, see aesd-rxbuf.h
+size_t aesd_rxbuf_pending(const aesd_rxbuf_t *rx)
+{
+	return rx->end - rx->start;
+}
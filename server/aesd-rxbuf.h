@@ -0,0 +1,116 @@
+/* Name	:	Sricharan Kidambi S
+   File	:	aesd-rxbuf.h
+   Brief	:	Per connection receive buffer for aesdsocket. Data is read from the socket in large chunks and
+   		packets are cut out of the buffer on their '\n' terminator, or by the length of their frame on a connection
+   		using the binary framing of aesd-frame.h.
+*/
+
+#ifndef AESD_RXBUF_H
+#define AESD_RXBUF_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "aesd-arena.h"
+
+// Capacity of a receive buffer on its first recv, doubled every time a packet does not fit
+#define AESD_RXBUF_INITIAL_SIZE 1024
+
+typedef enum aesd_framing
+{
+	AESD_FRAMING_UNKNOWN,		// nothing received yet
+	AESD_FRAMING_TEXT,
+	AESD_FRAMING_BINARY,
+}aesd_framing_t;
+
+typedef struct aesd_rxbuf
+{
+	/**
+	 * Received bytes, valid between start and end
+	 */
+	char *data;
+	size_t capacity;
+	/**
+	 * Arena of the connection the buffer grows in, set by the engine after aesd_rxbuf_init(). NULL, or a packet
+	 * outgrowing the arena, uses malloc().
+	 */
+	aesd_arena_t *arena;
+	/**
+	 * First byte of the packet which is being assembled
+	 */
+	size_t start;
+	/**
+	 * One past the last received byte
+	 */
+	size_t end;
+	/**
+	 * Bytes from start which are already known not to contain the terminator, so a packet spanning many
+	 * recv calls is only scanned once
+	 */
+	size_t scanned;
+	/**
+	 * Protocol of the connection, decided by its first byte
+	 */
+	aesd_framing_t framing;
+	/**
+	 * Size of the frame being received including its header, the buffer does not grow past it while the frame is
+	 * incomplete. 0 when unknown.
+	 */
+	size_t frame_size;
+	/**
+	 * aesd_opcode_t of the packet returned last, AESD_OP_TEXT on a text connection
+	 */
+	uint8_t opcode;
+	/**
+	 * aesd_metrics_now() of the accept, set by the engine and cleared once the first byte is received
+	 */
+	uint64_t accepted_at;
+	/**
+	 * aesd_metrics_now() of the first byte of the pending packet, 0 while nothing is pending
+	 */
+	uint64_t packet_started;
+}aesd_rxbuf_t;
+
+/* Function	: aesd_rxbuf_init
+ * Purpose	: initialize an empty receive buffer, no memory is allocated until the first recv
+ */
+void aesd_rxbuf_init(aesd_rxbuf_t *rx);
+
+/* Function	: aesd_rxbuf_free
+ * Purpose	: release the memory held by a receive buffer
+ */
+void aesd_rxbuf_free(aesd_rxbuf_t *rx);
+
+/* Function	: aesd_rxbuf_recv
+ * Purpose	: one recv() call into the free space at the end of the buffer. Consumed packets are compacted away
+ *		  first and the buffer grows geometrically when it is full.
+ * Parameters	: the receive buffer, socket to read from
+ * Returns	: the recv() result, bytes received, 0 on orderly shutdown or -1 with errno set
+ */
+ssize_t aesd_rxbuf_recv(aesd_rxbuf_t *rx, int sockfd);
+
+/* Function	: aesd_rxbuf_space / aesd_rxbuf_commit
+ * Purpose	: receive into the buffer without calling recv() here, for engines which submit the read themselves.
+ *		  aesd_rxbuf_space() compacts/grows like aesd_rxbuf_recv() and returns the free tail, aesd_rxbuf_commit()
+ *		  accounts for the bytes which were stored there, in the buffer and in the receive metrics.
+ * Returns	: aesd_rxbuf_space() returns NULL when memory could not be allocated
+ */
+char *aesd_rxbuf_space(aesd_rxbuf_t *rx, size_t *len);
+void aesd_rxbuf_commit(aesd_rxbuf_t *rx, size_t len);
+
+/* Function	: aesd_rxbuf_next_packet
+ * Purpose	: cut the next complete packet out of the buffer. Several packets received by a single recv are returned
+ *		  by consecutive calls. On a binary connection the packet is the payload of the next frame and rx->opcode
+ *		  tells what it is, a broken header is returned as an AESD_OP_INVALID packet.
+ * Parameters	: the receive buffer, returned packet start and length including the '\n'
+ * Returns	: true when a packet is returned. The packet stays valid until the next aesd_rxbuf_recv.
+ */
+bool aesd_rxbuf_next_packet(aesd_rxbuf_t *rx, const char **packet, size_t *len);
+
+/* Function	: aesd_rxbuf_pending
+ * Purpose	: number of received bytes which do not belong to a returned packet yet
+ */
+size_t aesd_rxbuf_pending(const aesd_rxbuf_t *rx);
+
+#endif /* AESD_RXBUF_H */
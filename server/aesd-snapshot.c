@@ -0,0 +1,130 @@
+/* Name	:	Sricharan Kidambi S
+   File	:	aesd-snapshot.c
+   Brief	:	Response snapshot cache of aesdsocket
+   Notes	:	1.	store_version counts completed writes. A writer appends first and bumps afterwards, a reader samples
+   				the version before it copies the store. A copy can therefore only be tagged older than its contents,
+   				never newer, and a stale tag just costs one more copy.
+   			2.	cache_lock only guards swapping and referencing the cached pointer. Copying the store happens under
+   				rebuild_lock, so when many readers find the cache stale at once the first one copies and the others
+   				take its snapshot once they get the lock.
+   			3.	The server must be the only writer of the store, a packet written to /dev/aesdchar by another
+   				process does not bump the version.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "aesd-snapshot.h"
+#include "aesd-metrics.h"
+
+// First allocation of a snapshot when the backend can not report its size
+#define SNAPSHOT_INITIAL_SIZE 4096
+
+static _Atomic uint64_t store_version = 1;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t rebuild_lock = PTHREAD_MUTEX_INITIALIZER;
+static aesd_snapshot_t *cached;
+
+// Make the cache stale, see aesd-snapshot.h
+void aesd_snapshot_bump(void)
+{
+	atomic_fetch_add_explicit(&store_version, 1, memory_order_release);
+}
+
+/* Function	: aesd_snapshot_lookup
+ * Purpose	: reference the cached snapshot when it is at least at version
+ * Returns	: the referenced snapshot, NULL when there is none or it is stale
+ */
+static aesd_snapshot_t *aesd_snapshot_lookup(uint64_t version)
+{
+	aesd_snapshot_t *snapshot = NULL;
+	pthread_mutex_lock(&cache_lock);
+	if(cached && (cached->version >= version)){
+		snapshot = cached;
+		atomic_fetch_add_explicit(&snapshot->refs, 1, memory_order_relaxed);
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return snapshot;
+}
+
+/* Function	: aesd_snapshot_read
+ * Purpose	: copy the whole store into a new snapshot tagged with version
+ * Returns	: the snapshot holding one reference, or NULL on failure
+ */
+static aesd_snapshot_t *aesd_snapshot_read(aesd_store_t *store, uint64_t version)
+{
+	off_t size = store->backend->size(store);
+	size_t capacity = (size > 0) ? (size_t) size : SNAPSHOT_INITIAL_SIZE;
+	aesd_snapshot_t *snapshot = malloc(sizeof(aesd_snapshot_t) + capacity);
+	if(!snapshot){
+		return NULL;
+	}
+	snapshot->len = 0;
+	while(1){
+		if(snapshot->len == capacity){
+			// The store grew since its size was taken, or the size was unknown
+			aesd_snapshot_t *grown = realloc(snapshot, sizeof(aesd_snapshot_t) + capacity * 2);
+			if(!grown){
+				free(snapshot);
+				return NULL;
+			}
+			snapshot = grown;
+			capacity *= 2;
+		}
+		ssize_t read_bytes = store->backend->read(store, snapshot->data + snapshot->len, capacity - snapshot->len, snapshot->len);
+		if(read_bytes < 0){
+			perror("read failed");
+			free(snapshot);
+			return NULL;
+		}
+		if(read_bytes == 0){
+			break;
+		}
+		snapshot->len += read_bytes;
+	}
+	atomic_init(&snapshot->refs, 1);
+	snapshot->version = version;
+	return snapshot;
+}
+
+// Reference the current snapshot, see aesd-snapshot.h
+aesd_snapshot_t *aesd_snapshot_get(aesd_store_t *store)
+{
+	uint64_t version = atomic_load_explicit(&store_version, memory_order_acquire);
+	aesd_snapshot_t *snapshot = aesd_snapshot_lookup(version);
+	if(snapshot){
+		aesd_metrics_add(AESD_METRIC_SNAPSHOT_HITS, 1);
+		return snapshot;
+	}
+	pthread_mutex_lock(&rebuild_lock);
+	// Another reader may have copied the store while this one waited
+	snapshot = aesd_snapshot_lookup(version);
+	if(snapshot){
+		pthread_mutex_unlock(&rebuild_lock);
+		aesd_metrics_add(AESD_METRIC_SNAPSHOT_HITS, 1);
+		return snapshot;
+	}
+	version = atomic_load_explicit(&store_version, memory_order_acquire);
+	snapshot = aesd_snapshot_read(store, version);
+	if(snapshot){
+		aesd_metrics_add(AESD_METRIC_SNAPSHOT_READS, 1);
+		// One reference for the cache, one for the caller
+		atomic_fetch_add_explicit(&snapshot->refs, 1, memory_order_relaxed);
+		pthread_mutex_lock(&cache_lock);
+		aesd_snapshot_t *stale = cached;
+		cached = snapshot;
+		pthread_mutex_unlock(&cache_lock);
+		aesd_snapshot_put(stale);
+	}
+	pthread_mutex_unlock(&rebuild_lock);
+	return snapshot;
+}
+
+// Drop a reference, see aesd-snapshot.h
+void aesd_snapshot_put(aesd_snapshot_t *snapshot)
+{
+	if(snapshot && (atomic_fetch_sub_explicit(&snapshot->refs, 1, memory_order_acq_rel) == 1)){
+		free(snapshot);
+	}
+}
@@ -0,0 +1,45 @@
+/* Name	:	Sricharan Kidambi S
+   File	:	aesd-snapshot.h
+   Brief	:	Cached copy of the whole store, shared by every response until a writer changes the store. Enabled
+   		with -C.
+*/
+
+#ifndef AESD_SNAPSHOT_H
+#define AESD_SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "aesd-store.h"
+
+// Immutable contents of the store at one version, freed when the last reference is dropped
+typedef struct aesd_snapshot
+{
+	atomic_int refs;
+	/**
+	 * Store version the contents were read at, the contents may already include later writes
+	 */
+	uint64_t version;
+	size_t len;
+	char data[];
+}aesd_snapshot_t;
+
+/* Function	: aesd_snapshot_bump
+ * Purpose	: called by every writer once its packets are in the store, makes the cached snapshot stale
+ */
+void aesd_snapshot_bump(void);
+
+/* Function	: aesd_snapshot_get
+ * Purpose	: reference the snapshot of the current store version. Only the first reader after a write reads the
+ *		  store (through the given handle), readers arriving meanwhile wait for that copy instead of reading too.
+ * Parameters	: a store handle to read with when the cache is stale
+ * Returns	: the referenced snapshot, or NULL when the store could not be read
+ */
+aesd_snapshot_t *aesd_snapshot_get(aesd_store_t *store);
+
+/* Function	: aesd_snapshot_put
+ * Purpose	: drop a reference taken with aesd_snapshot_get(), NULL is ignored
+ */
+void aesd_snapshot_put(aesd_snapshot_t *snapshot);
+
+#endif /* AESD_SNAPSHOT_H */
@@ -0,0 +1,286 @@
+/* Name	:	Sricharan Kidambi S
+   File	:	aesd-store.c
+   Brief	:	The three storage backends of aesdsocket: the aesdchar device, a plain file and an in-memory ring
+   Notes	:	1.	device and file share their implementation, every handle owns a descriptor opened with O_APPEND.
+   				Reads use pread() at the handle's own position, so the descriptor's file position is never relied
+   				upon and sendfile()/io_uring can work on the same descriptor.
+   			2.	Only the device knows packet boundaries, AESDCHAR_IOCSEEKTO:X,Y goes to its ioctl and the position
+   				the driver computed is read back with lseek(SEEK_CUR). AESDCHAR_IOCRANGE:X,Y,N uses the ioctl of
+   				the same name, which also returns where the N packets end. The file backend stores the command as data,
+   				which is what the file build always did.
+   			3.	The memory backend is the aesd_circular_buffer of the driver compiled into the server: the last
+   				AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED packets, the oldest one dropped on overflow. It costs no
+   				system call at all, so the network layer can be measured on its own.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include "../aesd-char-driver/aesd_ioctl.h"
+#include "../aesd-char-driver/aesd-circular-buffer.h"
+#include "aesd-store.h"
+
+/* Function	: store_fd_open / store_fd_close
+ * Purpose	: open or close the descriptor of a device or file handle
+ */
+static int store_fd_open(aesd_store_t *store)
+{
+	store->fd = open(store->backend->path, O_RDWR|O_CREAT|O_APPEND|O_CLOEXEC, 0777);
+	if(store->fd < 0){
+		perror("Unable to open the file");
+		return -1;
+	}
+	return 0;
+}
+
+static void store_fd_close(aesd_store_t *store)
+{
+	close(store->fd);
+	store->fd = -1;
+}
+
+/* Function	: store_fd_append
+ * Purpose	: writev() all packets, continuing after partial writes. The driver's write_iter commits a writev() under
+ *		  one lock and the O_APPEND writev() on the file is applied as a unit, so a batch never interleaves.
+ */
+static int store_fd_append(aesd_store_t *store, struct iovec *iov, int iovcnt)
+{
+	while(iovcnt > 0){
+		ssize_t written = writev(store->fd, iov, iovcnt);
+		if(written < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			perror("writev failed");
+			return -1;
+		}
+		while((iovcnt > 0) && ((size_t)written >= iov->iov_len)){
+			written -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if(iovcnt > 0){
+			iov->iov_base = (char *) iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+	return 0;
+}
+
+/* Function	: store_fd_read
+ * Purpose	: pread() at the requested offset, reads may come back short (older drivers return one packet per call)
+ */
+static ssize_t store_fd_read(aesd_store_t *store, char *buf, size_t len, off_t offset)
+{
+	ssize_t read_bytes;
+	while(((read_bytes = pread(store->fd, buf, len, offset)) < 0) && (errno == EINTR));
+	return read_bytes;
+}
+
+/* Function	: store_fd_size
+ * Purpose	: size of the store, the driver answers SEEK_END with the size of its circular buffer
+ */
+static off_t store_fd_size(aesd_store_t *store)
+{
+	return lseek(store->fd, 0, SEEK_END);
+}
+
+/* Function	: store_device_seek
+ * Purpose	: let the driver translate the packet and offset with AESDCHAR_IOCSEEKTO, or AESDCHAR_IOCRANGE when the
+ *		  response is bounded so the start and the end are computed under one driver lock
+ */
+static int store_device_seek(aesd_store_t *store, unsigned int write_cmd, unsigned int write_cmd_offset, unsigned int write_cmd_count)
+{
+	if(write_cmd_count > 0){
+		struct aesd_range range = { .write_cmd = write_cmd, .write_cmd_offset = write_cmd_offset, .write_cmd_count = write_cmd_count };
+		if(ioctl(store->fd, AESDCHAR_IOCRANGE, &range)) {
+			perror("ioctl failed.");
+			return -1;
+		}
+		store->end = range.end;
+	}
+	else{
+		struct aesd_seekto seekto = { .write_cmd = write_cmd, .write_cmd_offset = write_cmd_offset };
+		if(ioctl(store->fd, AESDCHAR_IOCSEEKTO, &seekto)) {
+			perror("ioctl failed.");
+			return -1;
+		}
+	}
+	off_t pos = lseek(store->fd, 0, SEEK_CUR);
+	if(pos < 0){
+		return -1;
+	}
+	store->pos = pos;
+	return 0;
+}
+
+/* Function	: store_file_sync
+ * Purpose	: flush appended packets of the file to the disk
+ */
+static int store_file_sync(aesd_store_t *store)
+{
+	return fdatasync(store->fd);
+}
+
+const aesd_store_backend_t aesd_store_device = {
+	.name = "device",
+	.path = AESD_STORE_DEVICE_PATH,
+	.fd_backed = true,
+	.timestamps = false,
+	.open = &store_fd_open,
+	.close = &store_fd_close,
+	.append = &store_fd_append,
+	.read = &store_fd_read,
+	.seek = &store_device_seek,
+	.size = &store_fd_size,
+	.sync = NULL,
+};
+
+const aesd_store_backend_t aesd_store_file = {
+	.name = "file",
+	.path = AESD_STORE_FILE_PATH,
+	.fd_backed = true,
+	.timestamps = true,
+	.open = &store_fd_open,
+	.close = &store_fd_close,
+	.append = &store_fd_append,
+	.read = &store_fd_read,
+	.seek = NULL,
+	.size = &store_fd_size,
+	.sync = &store_file_sync,
+};
+
+// The ring of the memory backend, shared by all handles. Writers also hold mutex_lock, readers only this lock.
+static struct aesd_buffer_entry memory_entries[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+static struct aesd_circular_buffer memory_ring = {
+	.entry = memory_entries,
+	.capacity = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED,
+};
+static pthread_rwlock_t memory_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* Function	: store_memory_open / store_memory_close
+ * Purpose	: a memory handle is nothing but its read position
+ */
+static int store_memory_open(aesd_store_t *store)
+{
+	store->fd = -1;
+	return 0;
+}
+
+static void store_memory_close(aesd_store_t *store)
+{
+	// The ring is shared by every connection and outlives them
+	(void) store;
+}
+
+/* Function	: store_memory_append
+ * Purpose	: copy every packet into its own ring entry, freeing the entry which falls out of the ring
+ */
+static int store_memory_append(aesd_store_t *store, struct iovec *packets, int count)
+{
+	(void) store;
+	int status = 0;
+	pthread_rwlock_wrlock(&memory_lock);
+	for(int i = 0; i < count; i++){
+		char *copy = malloc(packets[i].iov_len);
+		if(!copy){
+			status = -1;
+			break;
+		}
+		memcpy(copy, packets[i].iov_base, packets[i].iov_len);
+		struct aesd_buffer_entry entry = { .buffptr = copy, .size = packets[i].iov_len };
+		free((char *) aesd_circular_buffer_add_entry(&memory_ring, &entry));
+	}
+	pthread_rwlock_unlock(&memory_lock);
+	return status;
+}
+
+/* Function	: store_memory_read
+ * Purpose	: copy the requested range across entries, the way the driver's read() does
+ */
+static ssize_t store_memory_read(aesd_store_t *store, char *buf, size_t len, off_t offset)
+{
+	(void) store;
+	size_t copied = 0;
+	pthread_rwlock_rdlock(&memory_lock);
+	while(copied < len){
+		size_t entry_offset;
+		struct aesd_buffer_entry *entry = aesd_circular_buffer_find_entry_offset_for_fpos(&memory_ring, offset + copied, &entry_offset);
+		if(!entry){
+			break;
+		}
+		size_t chunk = entry->size - entry_offset;
+		chunk = (chunk > len - copied) ? len - copied : chunk;
+		memcpy(buf + copied, entry->buffptr + entry_offset, chunk);
+		copied += chunk;
+	}
+	pthread_rwlock_unlock(&memory_lock);
+	return copied;
+}
+
+/* Function	: store_memory_seek
+ * Purpose	: the AESDCHAR_IOCSEEKTO and AESDCHAR_IOCRANGE rules of the driver, with the driver's own helpers: the
+ *		  packet has to exist and the offset has to be inside it
+ */
+static int store_memory_seek(aesd_store_t *store, unsigned int write_cmd, unsigned int write_cmd_offset, unsigned int write_cmd_count)
+{
+	loff_t end = -1;
+	pthread_rwlock_rdlock(&memory_lock);
+	loff_t pos = aesd_circular_buffer_llseek(&memory_ring, write_cmd, write_cmd_offset);
+	if((pos >= 0) && (write_cmd_count > 0)){
+		end = aesd_circular_buffer_entries_end(&memory_ring, write_cmd, write_cmd_count);
+	}
+	pthread_rwlock_unlock(&memory_lock);
+	if(pos < 0){
+		errno = EINVAL;
+		return -1;
+	}
+	store->pos = pos;
+	if(write_cmd_count > 0){
+		store->end = end;
+	}
+	return 0;
+}
+
+/* Function	: store_memory_size
+ * Purpose	: bytes held by the ring
+ */
+static off_t store_memory_size(aesd_store_t *store)
+{
+	(void) store;
+	pthread_rwlock_rdlock(&memory_lock);
+	off_t size = get_the_total_buffer_size(&memory_ring);
+	pthread_rwlock_unlock(&memory_lock);
+	return size;
+}
+
+const aesd_store_backend_t aesd_store_memory = {
+	.name = "memory",
+	.path = NULL,
+	.fd_backed = false,
+	.timestamps = true,
+	.open = &store_memory_open,
+	.close = &store_memory_close,
+	.append = &store_memory_append,
+	.read = &store_memory_read,
+	.seek = &store_memory_seek,
+	.size = &store_memory_size,
+	.sync = NULL,
+};
+
+// Look up a backend by name, see aesd-store.h
+const aesd_store_backend_t *aesd_store_find(const char *name)
+{
+	static const aesd_store_backend_t *backends[] = { &aesd_store_device, &aesd_store_file, &aesd_store_memory };
+	for(size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++){
+		if(strcmp(backends[i]->name, name) == 0){
+			return backends[i];
+		}
+	}
+	return NULL;
+}
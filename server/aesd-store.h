@@ -0,0 +1,83 @@
+/* Name	:	Sricharan Kidambi S
+   File	:	aesd-store.h
+   Brief	:	Storage backends of aesdsocket, selected at run time with -B. Every backend appends whole packets,
+   		reads any byte range of the store, reports its size and may translate AESDCHAR_IOCSEEKTO:X,Y and AESDCHAR_IOCRANGE:X,Y,N to positions.
+*/
+
+#ifndef AESD_STORE_H
+#define AESD_STORE_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define AESD_STORE_DEVICE_PATH	"/dev/aesdchar"
+#define AESD_STORE_FILE_PATH	"/var/tmp/aesdsocketdata"
+
+typedef struct aesd_store aesd_store_t;
+
+typedef struct aesd_store_backend
+{
+	const char *name;
+	/**
+	 * Node or file holding the store, removed when the server exits. NULL for the memory backend.
+	 */
+	const char *path;
+	/**
+	 * Handles carry a descriptor which the kernel can read and write directly (sendfile, io_uring)
+	 */
+	bool fd_backed;
+	/**
+	 * Timestamps are appended by default, assignment 9 keeps them out of /dev/aesdchar
+	 */
+	bool timestamps;
+	/**
+	 * Prepare a handle, 0 on success or -1 on failure
+	 */
+	int (*open)(aesd_store_t *store);
+	void (*close)(aesd_store_t *store);
+	/**
+	 * Append every iovec as one packet, the caller holds mutex_lock. The iovecs may be modified.
+	 * 0 on success or -1 on failure.
+	 */
+	int (*append)(aesd_store_t *store, struct iovec *packets, int count);
+	/**
+	 * Copy up to len bytes starting at offset, returns the bytes copied (0 at the end) or -1
+	 */
+	ssize_t (*read)(aesd_store_t *store, char *buf, size_t len, off_t offset);
+	/**
+	 * Set store->pos to byte write_cmd_offset of packet write_cmd. With a write_cmd_count other than 0 also set
+	 * store->end behind that many packets (fewer when the store ends first). NULL when the backend has no packet
+	 * boundaries, the command is then stored like any other packet. 0 on success or -1 on failure.
+	 */
+	int (*seek)(aesd_store_t *store, unsigned int write_cmd, unsigned int write_cmd_offset, unsigned int write_cmd_count);
+	/**
+	 * Number of bytes in the store, or -1
+	 */
+	off_t (*size)(aesd_store_t *store);
+	/**
+	 * Make appended packets durable, NULL when there is nothing to flush
+	 */
+	int (*sync)(aesd_store_t *store);
+}aesd_store_backend_t;
+
+// One user of the store, each connection owns its own so read positions are independent
+struct aesd_store
+{
+	const aesd_store_backend_t *backend;
+	int fd;				// -1 unless the backend is fd_backed
+	off_t pos;			// where the next response starts, moved by store_packet() and seek
+	off_t end;			// where the response stops, -1 for the end of the store
+};
+
+extern const aesd_store_backend_t aesd_store_device;
+extern const aesd_store_backend_t aesd_store_file;
+extern const aesd_store_backend_t aesd_store_memory;
+
+/* Function	: aesd_store_find
+ * Purpose	: look up a backend by the name given to -B
+ * Returns	: the backend, or NULL for an unknown name
+ */
+const aesd_store_backend_t *aesd_store_find(const char *name);
+
+#endif /* AESD_STORE_H */
@@ -0,0 +1,448 @@
+/* Name	:	Sricharan Kidambi S
+   File	:	aesd-subscribe.c
+   Brief	:	Tail subscriptions of aesdsocket, see aesd-subscribe.h
+   Notes	:	1.	Every write publishes its packets as one message on a shared list. A subscriber only holds a cursor
+   				into that list, so a write costs one copy however many subscribers there are, and nothing at all
+   				while there are none. A message is referenced by the cursors on it, by its predecessor and by the
+   				list tail, and is freed once the last subscriber has moved past it.
+   			2.	A subscription is registered under mutex_lock like a write. The size of the store at that moment is
+   				where its catch-up read ends and the message list takes over, so no packet is skipped or sent twice.
+   				Two exceptions: io_uring writes are published after the fact, a packet in flight while a client
+   				subscribes may reach it twice; and on the device and memory rings packets falling out of the ring
+   				during a long catch-up shift the rest of it.
+   			3.	All subscriber sockets belong to one thread with its own epoll instance, the engines hand the socket
+   				over after the command and forget the connection. Writers wake the thread with an eventfd.
+   			4.	A subscriber whose backlog, the bytes published but not yet sent to it, grows past
+   				config.subscribe_limit is disconnected, or with -U drop skips whole messages until the rest fits
+   				again. Anything a subscriber sends is read and discarded, closing its side ends the subscription.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/queue.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "aesdsocket.h"
+#include "aesd-subscribe.h"
+#include "aesd-metrics.h"
+#include "aesd-log.h"
+
+#define SUBSCRIBE_MAX_EVENTS	64
+
+// Packets of one write, shared by every subscriber. Only data is read without hub_lock.
+typedef struct subscribe_msg
+{
+	int refs;
+	struct subscribe_msg *next;
+	uint64_t end;			// bytes published up to and including this message
+	size_t len;
+	char data[];
+}subscribe_msg_t;
+
+// One subscriber, only touched by the subscription thread once it is registered
+typedef struct subscriber
+{
+	int clientfd;
+	char client_ipaddress[INET6_ADDRSTRLEN];
+	aesd_store_t store;		// read position of the catch-up
+	off_t catchup_end;		// store size at subscription, the message list continues from there
+	store_stream_t stream;		// bounce buffer of the catch-up, released once it is sent
+	subscribe_msg_t *cursor;	// message being sent, holds a reference
+	size_t sent;			// bytes of cursor sent, cursor->len once it is done
+	struct subscriber *next_pending;
+	LIST_ENTRY(subscriber) entries;
+}subscriber_t;
+
+static pthread_mutex_t hub_lock = PTHREAD_MUTEX_INITIALIZER;
+static subscribe_msg_t *hub_tail;
+static uint64_t hub_published;
+static subscriber_t *hub_pending;
+// Read by writers without any lock, changes while mutex_lock is held are what matters to them
+static atomic_int hub_subscribers;
+static int hub_epfd = -1;
+static int hub_wakeup_fd = -1;
+static pthread_t hub_thread;
+// epoll user data of the wakeup eventfd, subscribers use their subscriber_t
+static int subscribe_wakeup_tag;
+static LIST_HEAD(subscriber_head, subscriber) subscribers;
+
+/* Function	: subscribe_msg_put
+ * Purpose	: drop a reference to a message, freeing every message nothing refers to anymore. Caller holds hub_lock.
+ */
+static void subscribe_msg_put(subscribe_msg_t *msg)
+{
+	// Freeing a message drops its reference to the next one
+	while(msg && (--msg->refs == 0)){
+		subscribe_msg_t *next = msg->next;
+		free(msg);
+		msg = next;
+	}
+}
+
+// Recognise the subscribe command, see aesd-subscribe.h
+bool aesd_subscribe_command(const char *packet, size_t len)
+{
+	return (len == strlen(AESD_SUBSCRIBE_COMMAND)) && (memcmp(packet, AESD_SUBSCRIBE_COMMAND, len) == 0);
+}
+
+// Publish appended packets, see aesd-subscribe.h
+void aesd_subscribe_publish(const struct iovec *packets, int count)
+{
+	if(atomic_load_explicit(&hub_subscribers, memory_order_relaxed) == 0){
+		return;
+	}
+	size_t len = 0;
+	for(int i = 0; i < count; i++){
+		len += packets[i].iov_len;
+	}
+	subscribe_msg_t *msg = (subscribe_msg_t *) malloc(sizeof(subscribe_msg_t) + len);
+	if(!msg){
+		AESD_LOG(LOG_ERR, "Subscribers miss %zu bytes, out of memory", len);
+		return;
+	}
+	msg->len = 0;
+	for(int i = 0; i < count; i++){
+		memcpy(msg->data + msg->len, packets[i].iov_base, packets[i].iov_len);
+		msg->len += packets[i].iov_len;
+	}
+	msg->next = NULL;
+	// Referenced by the old tail and as the new tail
+	msg->refs = 2;
+	pthread_mutex_lock(&hub_lock);
+	hub_published += len;
+	msg->end = hub_published;
+	subscribe_msg_t *previous = hub_tail;
+	previous->next = msg;
+	hub_tail = msg;
+	subscribe_msg_put(previous);
+	pthread_mutex_unlock(&hub_lock);
+	eventfd_write(hub_wakeup_fd, 1);
+}
+
+// Take over a subscribing connection, see aesd-subscribe.h
+int aesd_subscribe_add(int clientfd, const char *client_ipaddress)
+{
+	subscriber_t *sub = (subscriber_t *) calloc(1, sizeof(subscriber_t));
+	if(!sub){
+		return -1;
+	}
+	int flags = fcntl(clientfd, F_GETFL);
+	if((flags < 0) || (fcntl(clientfd, F_SETFL, flags | O_NONBLOCK) < 0) || (open_store(&sub->store) < 0)){
+		free(sub);
+		return -1;
+	}
+	sub->clientfd = clientfd;
+	strncpy(sub->client_ipaddress, client_ipaddress, sizeof(sub->client_ipaddress) - 1);
+	store_stream_init(&sub->stream);
+	// No writer may slip in between the size taken and the cursor set
+	aesd_metrics_lock(&mutex_lock);
+	sub->catchup_end = sub->store.backend->size(&sub->store);
+	if(sub->catchup_end < 0){
+		pthread_mutex_unlock(&mutex_lock);
+		close_store(&sub->store);
+		free(sub);
+		return -1;
+	}
+	pthread_mutex_lock(&hub_lock);
+	sub->cursor = hub_tail;
+	sub->cursor->refs++;
+	sub->sent = sub->cursor->len;
+	sub->next_pending = hub_pending;
+	hub_pending = sub;
+	atomic_fetch_add_explicit(&hub_subscribers, 1, memory_order_relaxed);
+	pthread_mutex_unlock(&hub_lock);
+	pthread_mutex_unlock(&mutex_lock);
+	eventfd_write(hub_wakeup_fd, 1);
+	aesd_metrics_add(AESD_METRIC_SUBSCRIBERS_OPENED, 1);
+	AESD_LOG(LOG_DEBUG, "%s subscribed from offset %lld", client_ipaddress, (long long) sub->catchup_end);
+	return 0;
+}
+
+/* Function	: subscriber_close
+ * Purpose	: end a subscription, closing the socket also drops it from the epoll set
+ */
+static void subscriber_close(subscriber_t *sub)
+{
+	LIST_REMOVE(sub, entries);
+	if(close(sub->clientfd) == 0){
+		AESD_LOG(LOG_DEBUG, "Closed subscription of %s", sub->client_ipaddress);
+	}
+	pthread_mutex_lock(&hub_lock);
+	subscribe_msg_put(sub->cursor);
+	pthread_mutex_unlock(&hub_lock);
+	atomic_fetch_sub_explicit(&hub_subscribers, 1, memory_order_relaxed);
+	aesd_metrics_add(AESD_METRIC_SUBSCRIBERS_CLOSED, 1);
+	aesd_metrics_add(AESD_METRIC_CONNECTIONS_CLOSED, 1);
+	close_store(&sub->store);
+	store_stream_free(&sub->stream);
+	free(sub);
+}
+
+/* Function	: subscriber_police
+ * Purpose	: apply the slow subscriber policy. Messages are only skipped between two messages, never inside the one
+ *		  being sent, so the client always sees whole packets. Caller holds hub_lock.
+ * Returns	: 0 to keep the subscriber, -1 to disconnect it
+ */
+static int subscriber_police(subscriber_t *sub)
+{
+	uint64_t delivered = sub->cursor->end - sub->cursor->len + sub->sent;
+	if(hub_published - delivered <= config.subscribe_limit){
+		return 0;
+	}
+	if(!config.subscribe_drop){
+		aesd_metrics_add(AESD_METRIC_SUBSCRIBE_DISCONNECTS, 1);
+		AESD_LOG(LOG_INFO, "Disconnecting %s, %llu bytes behind", sub->client_ipaddress, (unsigned long long)(hub_published - delivered));
+		return -1;
+	}
+	if(sub->sent < sub->cursor->len){
+		return 0;
+	}
+	while(sub->cursor->next && (hub_published - sub->cursor->end > config.subscribe_limit)){
+		subscribe_msg_t *next = sub->cursor->next;
+		next->refs++;
+		subscribe_msg_put(sub->cursor);
+		sub->cursor = next;
+		sub->sent = next->len;
+		aesd_metrics_add(AESD_METRIC_SUBSCRIBE_DROPPED, 1);
+	}
+	return 0;
+}
+
+/* Function	: subscriber_send
+ * Purpose	: send(), retried on EINTR
+ * Returns	: bytes sent, 0 when the socket is full, -1 on error
+ */
+static ssize_t subscriber_send(subscriber_t *sub, const char *data, size_t len)
+{
+	while(1){
+		ssize_t sent = send(sub->clientfd, data, len, MSG_NOSIGNAL);
+		if(sent >= 0){
+			aesd_metrics_add(AESD_METRIC_BYTES_OUT, sent);
+			return sent;
+		}
+		if(errno != EINTR){
+			return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -1;
+		}
+	}
+}
+
+/* Function	: subscriber_catchup
+ * Purpose	: send the store as it was when the subscription started
+ * Returns	: 1 when it is completely sent, 0 when the socket is full, -1 on error
+ */
+static int subscriber_catchup(subscriber_t *sub)
+{
+	store_stream_t *stream = &sub->stream;
+	while(1){
+		if(stream->bounce_sent < stream->bounce_bytes){
+			ssize_t sent = subscriber_send(sub, stream->bounce + stream->bounce_sent, stream->bounce_bytes - stream->bounce_sent);
+			if(sent <= 0){
+				return (int) sent;
+			}
+			stream->bounce_sent += sent;
+			continue;
+		}
+		if(sub->store.pos >= sub->catchup_end){
+			break;
+		}
+		if(store_stream_bounce(stream) < 0){
+			return -1;
+		}
+		off_t left = sub->catchup_end - sub->store.pos;
+		ssize_t read_bytes = sub->store.backend->read(&sub->store, stream->bounce, (left < STORE_STREAM_CHUNK) ? (size_t) left : STORE_STREAM_CHUNK, sub->store.pos);
+		if(read_bytes < 0){
+			perror("read failed");
+			return -1;
+		}
+		if(read_bytes == 0){
+			// The ring dropped packets meanwhile, there is less to send than there was
+			break;
+		}
+		sub->store.pos += read_bytes;
+		stream->bounce_bytes = read_bytes;
+		stream->bounce_sent = 0;
+	}
+	store_stream_free(stream);
+	sub->catchup_end = 0;
+	sub->store.pos = 0;
+	return 1;
+}
+
+/* Function	: subscriber_flush
+ * Purpose	: send whatever the subscriber has not seen yet, until it is up to date or its socket is full
+ * Returns	: 0 to keep the subscriber, -1 to close it
+ */
+static int subscriber_flush(subscriber_t *sub)
+{
+	pthread_mutex_lock(&hub_lock);
+	int status = subscriber_police(sub);
+	pthread_mutex_unlock(&hub_lock);
+	if(status < 0){
+		return -1;
+	}
+	status = subscriber_catchup(sub);
+	if(status <= 0){
+		return status;
+	}
+	while(1){
+		pthread_mutex_lock(&hub_lock);
+		if(subscriber_police(sub) < 0){
+			pthread_mutex_unlock(&hub_lock);
+			return -1;
+		}
+		if(sub->sent == sub->cursor->len){
+			subscribe_msg_t *next = sub->cursor->next;
+			if(!next){
+				pthread_mutex_unlock(&hub_lock);
+				return 0;
+			}
+			next->refs++;
+			subscribe_msg_put(sub->cursor);
+			sub->cursor = next;
+			sub->sent = 0;
+		}
+		pthread_mutex_unlock(&hub_lock);
+		// The cursor reference keeps the data alive, it is never written after publishing
+		ssize_t sent = subscriber_send(sub, sub->cursor->data + sub->sent, sub->cursor->len - sub->sent);
+		if(sent <= 0){
+			return (int) sent;
+		}
+		sub->sent += sent;
+	}
+}
+
+/* Function	: subscriber_handle
+ * Purpose	: react to readiness of one subscriber socket
+ */
+static void subscriber_handle(subscriber_t *sub, uint32_t events)
+{
+	if(events & (EPOLLERR | EPOLLHUP)){
+		subscriber_close(sub);
+		return;
+	}
+	if(events & (EPOLLIN | EPOLLRDHUP)){
+		char discard[512];
+		while(1){
+			ssize_t receive_bytes = recv(sub->clientfd, discard, sizeof(discard), 0);
+			if(receive_bytes > 0){
+				continue;
+			}
+			if((receive_bytes < 0) && (errno == EINTR)){
+				continue;
+			}
+			if((receive_bytes < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))){
+				break;
+			}
+			// The subscriber closed its side, or the socket failed
+			subscriber_close(sub);
+			return;
+		}
+	}
+	if(subscriber_flush(sub) < 0){
+		subscriber_close(sub);
+	}
+}
+
+/* Function	: subscribe_woken
+ * Purpose	: register new subscribers and push newly published messages to everyone
+ */
+static void subscribe_woken(void)
+{
+	eventfd_t count;
+	eventfd_read(hub_wakeup_fd, &count);
+	pthread_mutex_lock(&hub_lock);
+	subscriber_t *sub = hub_pending;
+	hub_pending = NULL;
+	pthread_mutex_unlock(&hub_lock);
+	while(sub){
+		subscriber_t *next = sub->next_pending;
+		LIST_INSERT_HEAD(&subscribers, sub, entries);
+		struct epoll_event event = {0};
+		event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		event.data.ptr = sub;
+		if(epoll_ctl(hub_epfd, EPOLL_CTL_ADD, sub->clientfd, &event) < 0){
+			perror("epoll_ctl add subscriber");
+			subscriber_close(sub);
+		}
+		sub = next;
+	}
+	sub = LIST_FIRST(&subscribers);
+	while(sub){
+		subscriber_t *next = LIST_NEXT(sub, entries);
+		if(subscriber_flush(sub) < 0){
+			subscriber_close(sub);
+		}
+		sub = next;
+	}
+}
+
+/* Function	: subscribe_loop
+ * Purpose	: body of the subscription thread
+ */
+static void *subscribe_loop(void *thread_param)
+{
+	struct epoll_event events[SUBSCRIBE_MAX_EVENTS];
+	while(1){
+		int ready = epoll_wait(hub_epfd, events, SUBSCRIBE_MAX_EVENTS, -1);
+		if(ready < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			perror("epoll_wait");
+			break;
+		}
+		bool woken = false;
+		for(int i = 0; i < ready; i++){
+			if(events[i].data.ptr == &subscribe_wakeup_tag){
+				// Handled last, it may close subscribers which still have an event in this batch
+				woken = true;
+			}
+			else{
+				subscriber_handle((subscriber_t *) events[i].data.ptr, events[i].events);
+			}
+		}
+		if(woken){
+			subscribe_woken();
+		}
+	}
+	return thread_param;
+}
+
+// Start the subscription thread, see aesd-subscribe.h
+int aesd_subscribe_start(void)
+{
+	// Where the first subscribers start, an empty message nothing was published to yet
+	hub_tail = (subscribe_msg_t *) calloc(1, sizeof(subscribe_msg_t));
+	if(!hub_tail){
+		return -1;
+	}
+	hub_tail->refs = 1;
+	LIST_INIT(&subscribers);
+	hub_epfd = epoll_create1(EPOLL_CLOEXEC);
+	hub_wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if((hub_epfd < 0) || (hub_wakeup_fd < 0)){
+		perror("Unable to create the subscription epoll instance");
+		return -1;
+	}
+	struct epoll_event event = {0};
+	event.events = EPOLLIN;
+	event.data.ptr = &subscribe_wakeup_tag;
+	if(epoll_ctl(hub_epfd, EPOLL_CTL_ADD, hub_wakeup_fd, &event) < 0){
+		perror("epoll_ctl add subscription wakeup");
+		return -1;
+	}
+	if(pthread_create(&hub_thread, NULL, &subscribe_loop, NULL) != 0){
+		perror("Unable to start the subscription thread");
+		return -1;
+	}
+	return 0;
+}
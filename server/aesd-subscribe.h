@@ -0,0 +1,45 @@
+/* Name	:	Sricharan Kidambi S
+   File	:	aesd-subscribe.h
+   Brief	:	Tail subscriptions of aesdsocket. A client sending AESDCHAR_SUBSCRIBE gets the store once and then every
+   		packet written afterwards, pushed to it as it is committed, instead of polling with reconnects.
+*/
+
+#ifndef AESD_SUBSCRIBE_H
+#define AESD_SUBSCRIBE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+
+// The whole packet a client sends to turn its connection into a subscription
+#define AESD_SUBSCRIBE_COMMAND "AESDCHAR_SUBSCRIBE\n"
+
+// Bytes published but not yet sent a subscriber may fall behind when -u is not given
+#define AESD_SUBSCRIBE_DEFAULT_LIMIT (1024 * 1024)
+
+/* Function	: aesd_subscribe_start
+ * Purpose	: start the thread owning all subscriber sockets
+ * Returns	: 0 on success, -1 on failure
+ */
+int aesd_subscribe_start(void);
+
+/* Function	: aesd_subscribe_command
+ * Purpose	: whether a received packet is the subscribe command
+ */
+bool aesd_subscribe_command(const char *packet, size_t len);
+
+/* Function	: aesd_subscribe_add
+ * Purpose	: hand a connection which sent the subscribe command over to the subscription thread. The engine forgets
+ *		  the connection afterwards, anything it still buffered from the client is dropped.
+ * Parameters	: the client socket and its address for the log
+ * Returns	: 0 when the socket belongs to the subscription thread now, -1 when the caller still has to close it
+ */
+int aesd_subscribe_add(int clientfd, const char *client_ipaddress);
+
+/* Function	: aesd_subscribe_publish
+ * Purpose	: push packets which were just appended to the store to every subscriber. Called by every writer while it
+ *		  still holds mutex_lock, costs nothing while there are no subscribers.
+ */
+void aesd_subscribe_publish(const struct iovec *packets, int count);
+
+#endif /* AESD_SUBSCRIBE_H */
@@ -0,0 +1,541 @@
+/* Name	:	Sricharan Kidambi S
+   File	:	aesd-uring.c
+   Brief	:	io_uring based connection engine for aesdsocket, built with "make USE_IO_URING=y" and selected with -m uring
+   References	:	https://unixism.net/loti/ - Lord of the io_uring, liburing usage
+   			https://man7.org/linux/man-pages/man7/io_uring.7.html
+   Notes	:	1.	Every engine thread owns one ring. accept, recv, the write of a packet to the store, the read back of
+   				the store and the send of the response are all submitted to that ring, and the completions of all
+   				connections of the thread are reaped and resubmitted with a single io_uring_enter() per iteration.
+   			2.	A connection has at most one operation in flight, it moves RECV -> WRITE -> READ/SEND ... -> RECV (or
+   				close). The connection pointer is the user data of the operation, so a completion always finds its
+   				connection. AESDCHAR_IOCSEEKTO:X,Y is applied synchronously with store_seek(), there is no ioctl opcode.
+   				AESDCHAR_SUBSCRIBE hands the socket over to the subscription thread (aesd-subscribe.c).
+   			3.	Store reads start at the connection's store position, which store_seek() and the end of a write set
+   				exactly as in the blocking engines. Writes use offset -1 on the O_APPEND descriptor of the device or
+   				file backend, whole packets keep connections from interleaving without holding mutex_lock across
+   				the asynchronous write. The memory backend has no descriptor and is not supported here.
+   			4.	With -C there is no READ, the response is sent straight from the cached snapshot of aesd-snapshot.c.
+   			5.	In session mode the recv is linked to an IORING_OP_LINK_TIMEOUT of session_timeout seconds, an idle
+   				client sees its recv cancelled and is disconnected.
+   			6.	Every ring polls the drain eventfd of aesd-drain.c. Once it fires the accept in flight is cancelled
+   				and not queued again, connections already accepted are served to the end.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <liburing.h>
+#include "aesdsocket.h"
+#include "aesd-rxbuf.h"
+#include "aesd-metrics.h"
+#include "aesd-snapshot.h"
+#include "aesd-subscribe.h"
+#include "aesd-log.h"
+#include "aesd-drain.h"
+
+// Submission queue entries of every ring, completions are reaped long before this many are outstanding
+#define URING_ENTRIES 256
+
+typedef enum uring_state
+{
+	URING_RECV,
+	URING_WRITE,
+	URING_READ,
+	URING_SEND,
+}uring_state_t;
+
+typedef struct uring_conn
+{
+	aesd_arena_t *arena;		// holds this structure and the buffers of the connection
+	int clientfd;
+	aesd_store_t store;
+	char client_ipaddress[INET6_ADDRSTRLEN];
+	uring_state_t state;
+	aesd_rxbuf_t rx;
+	const char *packet;		// packet being written to the store, points into rx
+	size_t packet_bytes;
+	size_t packet_written;
+	store_stream_t stream;		// the bounce buffer carries the store from READ to SEND
+	uint64_t op_started;		// aesd_metrics_now() when the store write or the response started
+}uring_conn_t;
+
+typedef struct uring_engine
+{
+	pthread_t thread;
+	int sockfd;
+	struct io_uring ring;
+	/**
+	 * Target of the accept in flight, the ring holds at most one
+	 */
+	struct sockaddr_in clientadd;
+	socklen_t clientlen;
+	/**
+	 * Link timeout of session recvs, read by the kernel when the recv is submitted
+	 */
+	struct __kernel_timespec idle;
+	/**
+	 * A drain started, the accept is not queued again
+	 */
+	bool draining;
+}uring_engine_t;
+
+// User data of the accept and drain poll operations, distinguishes them from connection operations and from link
+// timeouts and cancels (NULL)
+static int uring_accept_tag;
+static int uring_drain_tag;
+
+/* Function	: uring_sqe
+ * Purpose	: get a free submission queue entry, submitting what is queued when the queue is full
+ */
+static struct io_uring_sqe *uring_sqe(uring_engine_t *engine)
+{
+	struct io_uring_sqe *sqe;
+	while((sqe = io_uring_get_sqe(&engine->ring)) == NULL){
+		io_uring_submit(&engine->ring);
+	}
+	return sqe;
+}
+
+/* Function	: uring_sq_reserve
+ * Purpose	: make room for count entries queued back to back, so a linked chain is never split by a submit
+ */
+static void uring_sq_reserve(uring_engine_t *engine, unsigned int count)
+{
+	while(io_uring_sq_space_left(&engine->ring) < count){
+		io_uring_submit(&engine->ring);
+	}
+}
+
+/* Function	: uring_queue_accept
+ * Purpose	: keep one accept in flight on the listening socket
+ */
+static void uring_queue_accept(uring_engine_t *engine)
+{
+	struct io_uring_sqe *sqe = uring_sqe(engine);
+	engine->clientlen = sizeof(engine->clientadd);
+	io_uring_prep_accept(sqe, engine->sockfd, (struct sockaddr *) &engine->clientadd, &engine->clientlen, SOCK_CLOEXEC);
+	io_uring_sqe_set_data(sqe, &uring_accept_tag);
+}
+
+/* Function	: uring_drain
+ * Purpose	: stop accepting once the drain eventfd fired, the cancelled accept completes with -ECANCELED
+ */
+static void uring_drain(uring_engine_t *engine)
+{
+	engine->draining = true;
+	struct io_uring_sqe *sqe = uring_sqe(engine);
+	io_uring_prep_cancel(sqe, &uring_accept_tag, 0);
+	io_uring_sqe_set_data(sqe, NULL);
+}
+
+/* Function	: uring_close_conn
+ * Purpose	: release a connection, only called from a completion so nothing of it is in flight anymore. A socket
+ *		  handed over to the subscription thread is -1 and stays open.
+ */
+static void uring_close_conn(uring_conn_t *conn)
+{
+	if(conn->clientfd >= 0){
+		aesd_metrics_add(AESD_METRIC_CONNECTIONS_CLOSED, 1);
+		if(close(conn->clientfd) == 0){
+			AESD_LOG(LOG_DEBUG, "Closed connection from %s", conn->client_ipaddress);
+		}
+	}
+	close_store(&conn->store);
+	aesd_rxbuf_free(&conn->rx);
+	store_stream_free(&conn->stream);
+	aesd_arena_put(conn->arena);
+}
+
+/* Function	: uring_queue_recv
+ * Purpose	: receive into the free space of the connection's receive buffer
+ * Returns	: 0 on success, -1 when the receive buffer could not grow
+ */
+static int uring_queue_recv(uring_engine_t *engine, uring_conn_t *conn)
+{
+	size_t space;
+	char *tail = aesd_rxbuf_space(&conn->rx, &space);
+	if(!tail){
+		return -1;
+	}
+	// The recv and its link timeout have to reach the kernel in the same submit
+	if(config.session_timeout > 0){
+		uring_sq_reserve(engine, 2);
+	}
+	struct io_uring_sqe *sqe = uring_sqe(engine);
+	io_uring_prep_recv(sqe, conn->clientfd, tail, space, 0);
+	io_uring_sqe_set_data(sqe, conn);
+	conn->state = URING_RECV;
+	if(config.session_timeout > 0){
+		sqe->flags |= IOSQE_IO_LINK;
+		sqe = uring_sqe(engine);
+		io_uring_prep_link_timeout(sqe, &engine->idle, 0);
+		io_uring_sqe_set_data(sqe, NULL);
+	}
+	return 0;
+}
+
+/* Function	: uring_queue_write
+ * Purpose	: write the rest of the current packet to the store
+ */
+static void uring_queue_write(uring_engine_t *engine, uring_conn_t *conn)
+{
+	struct io_uring_sqe *sqe = uring_sqe(engine);
+	io_uring_prep_write(sqe, conn->store.fd, conn->packet + conn->packet_written, conn->packet_bytes - conn->packet_written, (__u64) -1);
+	io_uring_sqe_set_data(sqe, conn);
+	conn->state = URING_WRITE;
+}
+
+static int uring_next_packet(uring_engine_t *engine, uring_conn_t *conn);
+
+/* Function	: uring_responded
+ * Purpose	: the whole response is sent, move on to the next packet unless the connection closes
+ * Returns	: 0 when an operation was queued, -1 when the connection has to be closed
+ */
+static int uring_responded(uring_engine_t *engine, uring_conn_t *conn)
+{
+	aesd_metrics_record(AESD_METRIC_SEND, conn->op_started);
+	//Once the store is transmitted, close the socket unless the client keeps a session
+	if(config.session_timeout == 0){
+		return -1;
+	}
+	return uring_next_packet(engine, conn);
+}
+
+/* Function	: uring_queue_snapshot
+ * Purpose	: send the rest of the cached snapshot from the current store position
+ * Returns	: 0 when an operation was queued, -1 when the connection has to be closed
+ */
+static int uring_queue_snapshot(uring_engine_t *engine, uring_conn_t *conn)
+{
+	if(!conn->stream.snapshot){
+		conn->stream.snapshot = aesd_snapshot_get(&conn->store);
+		if(!conn->stream.snapshot){
+			return -1;
+		}
+	}
+	size_t len = conn->stream.snapshot->len;
+	if((conn->store.end >= 0) && ((size_t) conn->store.end < len)){
+		len = conn->store.end;
+	}
+	if((size_t) conn->store.pos >= len){
+		aesd_snapshot_put(conn->stream.snapshot);
+		conn->stream.snapshot = NULL;
+		return uring_responded(engine, conn);
+	}
+	struct io_uring_sqe *sqe = uring_sqe(engine);
+	io_uring_prep_send(sqe, conn->clientfd, conn->stream.snapshot->data + conn->store.pos, len - conn->store.pos, MSG_NOSIGNAL);
+	io_uring_sqe_set_data(sqe, conn);
+	conn->state = URING_SEND;
+	return 0;
+}
+
+/* Function	: uring_queue_send
+ * Purpose	: send the rest of the bounce buffer to the client
+ */
+static void uring_queue_send(uring_engine_t *engine, uring_conn_t *conn)
+{
+	struct io_uring_sqe *sqe = uring_sqe(engine);
+	io_uring_prep_send(sqe, conn->clientfd, conn->stream.bounce + conn->stream.bounce_sent, conn->stream.bounce_bytes - conn->stream.bounce_sent, MSG_NOSIGNAL);
+	io_uring_sqe_set_data(sqe, conn);
+	conn->state = URING_SEND;
+}
+
+/* Function	: uring_read_done
+ * Purpose	: the response window is read completely, send the empty frame ending a framed response or finish
+ * Returns	: 0 when an operation was queued, -1 when the connection has to be closed
+ */
+static int uring_read_done(uring_engine_t *engine, uring_conn_t *conn)
+{
+	if(!conn->stream.framed){
+		return uring_responded(engine, conn);
+	}
+	aesd_frame_header(conn->stream.bounce, AESD_OP_DATA, 0);
+	conn->stream.bounce_bytes = AESD_FRAME_HEADER_SIZE;
+	conn->stream.bounce_sent = 0;
+	conn->stream.trailer = true;
+	uring_queue_send(engine, conn);
+	return 0;
+}
+
+/* Function	: uring_queue_read
+ * Purpose	: read the next chunk of the response window into the bounce buffer, behind the room for its frame
+ *		  header on a binary connection
+ * Returns	: 0 when an operation was queued, -1 when the connection has to be closed
+ */
+static int uring_queue_read(uring_engine_t *engine, uring_conn_t *conn)
+{
+	if(config.snapshot_cache && !conn->stream.framed){
+		return uring_queue_snapshot(engine, conn);
+	}
+	if(store_stream_bounce(&conn->stream) < 0){
+		return -1;
+	}
+	size_t limit = store_stream_limit(&conn->store);
+	if(limit == 0){
+		return uring_read_done(engine, conn);
+	}
+	size_t header = conn->stream.framed ? AESD_FRAME_HEADER_SIZE : 0;
+	struct io_uring_sqe *sqe = uring_sqe(engine);
+	io_uring_prep_read(sqe, conn->store.fd, conn->stream.bounce + header, limit, conn->store.pos);
+	io_uring_sqe_set_data(sqe, conn);
+	conn->state = URING_READ;
+	return 0;
+}
+
+/* Function	: uring_next_packet
+ * Purpose	: start on the next buffered packet, or go back to receiving when none is complete
+ * Returns	: 0 when an operation was queued, -1 when the connection has to be closed
+ */
+static int uring_next_packet(uring_engine_t *engine, uring_conn_t *conn)
+{
+	if(!aesd_rxbuf_next_packet(&conn->rx, &conn->packet, &conn->packet_bytes)){
+		return uring_queue_recv(engine, conn);
+	}
+	if((conn->rx.opcode == AESD_OP_TEXT) && aesd_subscribe_command(conn->packet, conn->packet_bytes)){
+		// Closing the connection only releases it once the subscription thread owns the socket
+		if(aesd_subscribe_add(conn->clientfd, conn->client_ipaddress) == 0){
+			conn->clientfd = -1;
+		}
+		return -1;
+	}
+	conn->stream.framed = (conn->rx.framing == AESD_FRAMING_BINARY);
+	int seek_status = store_seek(&conn->store, conn->rx.opcode, conn->packet, conn->packet_bytes);
+	if(seek_status < 0){
+		return -1;
+	}
+	if(seek_status > 0){
+		// The ioctl moved the file position, respond from there
+		conn->op_started = aesd_metrics_now();
+		return uring_queue_read(engine, conn);
+	}
+	conn->packet_written = 0;
+	conn->op_started = aesd_metrics_now();
+	uring_queue_write(engine, conn);
+	return 0;
+}
+
+/* Function	: uring_accepted
+ * Purpose	: set up a freshly accepted connection and queue its first recv
+ */
+static void uring_accepted(uring_engine_t *engine, int clientfd)
+{
+	aesd_arena_t *arena = aesd_arena_get();
+	uring_conn_t *conn = arena ? (uring_conn_t *) aesd_arena_alloc(arena, sizeof(uring_conn_t)) : NULL;
+	if(!conn){
+		aesd_arena_put(arena);
+		close(clientfd);
+		return;
+	}
+	memset(conn, 0, sizeof(uring_conn_t));
+	conn->arena = arena;
+	conn->clientfd = clientfd;
+	aesd_metrics_add(AESD_METRIC_CONNECTIONS_OPENED, 1);
+	aesd_rxbuf_init(&conn->rx);
+	conn->rx.accepted_at = aesd_metrics_now();
+	conn->rx.arena = arena;
+	store_stream_init(&conn->stream);
+	conn->stream.arena = arena;
+	int store_status = open_store(&conn->store);
+	inet_ntop(AF_INET, &engine->clientadd.sin_addr, conn->client_ipaddress, sizeof(conn->client_ipaddress));
+	AESD_LOG(LOG_DEBUG, "Accepted a connection from %s", conn->client_ipaddress);
+	if((store_status < 0) || (uring_queue_recv(engine, conn) < 0)){
+		uring_close_conn(conn);
+		return;
+	}
+}
+
+/* Function	: uring_complete
+ * Purpose	: advance the state machine of a connection after one of its operations completed
+ * Returns	: 0 when the next operation was queued, -1 when the connection has to be closed
+ */
+static int uring_complete(uring_engine_t *engine, uring_conn_t *conn, int res)
+{
+	switch(conn->state){
+	case URING_RECV:
+		if(res == -ECANCELED){
+			AESD_LOG(LOG_DEBUG, "Idle session from %s timed out", conn->client_ipaddress);
+			return -1;
+		}
+		if(res <= 0){
+			// Error, or the peer went away
+			return -1;
+		}
+		aesd_rxbuf_commit(&conn->rx, res);
+		return uring_next_packet(engine, conn);
+	case URING_WRITE:
+		if(res < 0){
+			errno = -res;
+			perror("write failed\n");
+			return -1;
+		}
+		conn->packet_written += res;
+		if(conn->packet_written < conn->packet_bytes){
+			uring_queue_write(engine, conn);
+			return 0;
+		}
+		aesd_metrics_record(AESD_METRIC_STORE_WRITE, conn->op_started);
+		aesd_snapshot_bump();
+		// Published after the fact, mutex_lock only orders it against subscriptions starting
+		struct iovec published = { .iov_base = (void *) conn->packet, .iov_len = conn->packet_bytes };
+		aesd_metrics_lock(&mutex_lock);
+		aesd_subscribe_publish(&published, 1);
+		pthread_mutex_unlock(&mutex_lock);
+		// The whole store is sent back after a write
+		conn->store.pos = 0;
+		conn->op_started = aesd_metrics_now();
+		conn->stream.bounce_bytes = 0;
+		conn->stream.bounce_sent = 0;
+		return uring_queue_read(engine, conn);
+	case URING_READ:
+		if(res < 0){
+			errno = -res;
+			perror("read failed");
+			return -1;
+		}
+		if(res == 0){
+			return uring_read_done(engine, conn);
+		}
+		if(conn->stream.framed){
+			aesd_frame_header(conn->stream.bounce, AESD_OP_DATA, res);
+			conn->stream.bounce_bytes = AESD_FRAME_HEADER_SIZE + res;
+		}
+		else{
+			conn->stream.bounce_bytes = res;
+		}
+		conn->store.pos += res;
+		conn->stream.bounce_sent = 0;
+		uring_queue_send(engine, conn);
+		return 0;
+	case URING_SEND:
+		if(res < 0){
+			return -1;
+		}
+		aesd_metrics_add(AESD_METRIC_BYTES_OUT, res);
+		if(conn->stream.snapshot){
+			conn->store.pos += res;
+			return uring_queue_snapshot(engine, conn);
+		}
+		conn->stream.bounce_sent += res;
+		if(conn->stream.bounce_sent < conn->stream.bounce_bytes){
+			uring_queue_send(engine, conn);
+			return 0;
+		}
+		if(conn->stream.trailer){
+			conn->stream.trailer = false;
+			return uring_responded(engine, conn);
+		}
+		return uring_queue_read(engine, conn);
+	}
+	return -1;
+}
+
+/* Function	: uring_loop
+ * Purpose	: body of one engine thread, submit everything queued and reap every completion in one system call
+ */
+static void *uring_loop(void *thread_param)
+{
+	uring_engine_t *engine = (uring_engine_t *) thread_param;
+	uring_queue_accept(engine);
+	struct io_uring_sqe *sqe = uring_sqe(engine);
+	io_uring_prep_poll_add(sqe, aesd_drain_fd(), POLLIN);
+	io_uring_sqe_set_data(sqe, &uring_drain_tag);
+	while(1){
+		int submitted = io_uring_submit_and_wait(&engine->ring, 1);
+		if(submitted < 0){
+			// Only a stray signal interrupts the wait, timestamps come from the timer thread
+			if(submitted == -EINTR){
+				continue;
+			}
+			errno = -submitted;
+			perror("io_uring_submit_and_wait");
+			break;
+		}
+		struct io_uring_cqe *cqe;
+		unsigned head;
+		unsigned reaped = 0;
+		io_uring_for_each_cqe(&engine->ring, head, cqe){
+			void *data = io_uring_cqe_get_data(cqe);
+			reaped++;
+			if(data == NULL){
+				// Completion of a link timeout or of a cancel, the cancelled operation reports the outcome
+				continue;
+			}
+			if(data == &uring_drain_tag){
+				uring_drain(engine);
+				continue;
+			}
+			if(data == &uring_accept_tag){
+				if(cqe->res >= 0){
+					uring_accepted(engine, cqe->res);
+				}
+				else if((cqe->res != -EAGAIN) && (cqe->res != -EINTR) && (cqe->res != -ECONNABORTED) && (cqe->res != -ECANCELED)){
+					errno = -cqe->res;
+					perror("Error in accepting\n");
+				}
+				// A connection accepted while the cancel was on its way is still served
+				if(engine->draining){
+					aesd_drain_leave();
+				}
+				else{
+					uring_queue_accept(engine);
+				}
+				continue;
+			}
+			uring_conn_t *conn = (uring_conn_t *) data;
+			if(uring_complete(engine, conn, cqe->res) < 0){
+				uring_close_conn(conn);
+			}
+		}
+		io_uring_cq_advance(&engine->ring, reaped);
+	}
+	return thread_param;
+}
+
+// Start the io_uring engine threads, see aesdsocket.h
+int aesd_uring_run(const int *sockfds, int nlisteners, int nthreads)
+{
+	if(!config.backend->fd_backed){
+		fprintf(stderr, "The io_uring engine needs a descriptor backed store, use -B device or -B file\n");
+		return -1;
+	}
+	uring_engine_t *engines = (uring_engine_t *) calloc(nthreads, sizeof(uring_engine_t));
+	if(!engines){
+		return -1;
+	}
+	int started = 0;
+	for(int i = 0; i < nthreads; i++){
+		engines[i].sockfd = sockfds[i % nlisteners];
+		engines[i].idle.tv_sec = config.session_timeout;
+		engines[i].idle.tv_nsec = 0;
+		int status = io_uring_queue_init(URING_ENTRIES, &engines[i].ring, 0);
+		if(status < 0){
+			errno = -status;
+			perror("io_uring_queue_init");
+			break;
+		}
+		aesd_drain_join();
+		if(pthread_create(&engines[i].thread, NULL, &uring_loop, &engines[i]) != 0){
+			perror("pthread_create");
+			aesd_drain_leave();
+			io_uring_queue_exit(&engines[i].ring);
+			break;
+		}
+		aesd_set_affinity(engines[i].thread, i);
+		started++;
+	}
+	for(int i = 0; i < started; i++){
+		pthread_join(engines[i].thread, NULL);
+		io_uring_queue_exit(&engines[i].ring);
+	}
+	free(engines);
+	return -1;
+}
@@ -0,0 +1,441 @@
+/* Name	:	Sricharan Kidambi S
+   File	:	aesdbench.c
+   Brief	:	Load generator and benchmark client for the aesdsocket protocol, built with "make bench"
+   Notes	:	1.	Every connection runs on its own thread and sends -n packets of -s bytes, at most -r per second.
+   				Without -S every packet uses a fresh connection and the response ends when the server closes it,
+   				exactly like the one packet per connection protocol. With -S one connection carries all packets
+   				of a thread, the server has to run with -s.
+   			2.	Packets are "c<connection>-<sequence>-xxx...\n", so every packet in the store is unique. A
+   				response passes verification when it is made of complete lines and contains the packet it answers.
+   				With -k every k-th packet is an AESDCHAR_IOCSEEKTO:X,0 command instead, its response only has to be
+   				made of complete lines. Seek commands need the aesdchar backend, the file backend stores them.
+   			3.	A session response has no end marker. It is taken as complete once it ends on a line boundary and
+   				contains the packet just sent. Lines which other clients appended after that packet may still
+   				arrive, they are counted in the next response.
+   			4.	Latency runs from the time a packet was due (not when it was actually sent) until its response
+   				is complete, so a slow server is not hidden by a rate limited client. All samples are kept and
+   				sorted for exact percentiles.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define BENCH_DEFAULT_HOST		"127.0.0.1"
+#define BENCH_DEFAULT_PORT		"9000"
+#define BENCH_DEFAULT_CONNECTIONS	4
+#define BENCH_DEFAULT_PACKETS		100
+#define BENCH_DEFAULT_SIZE		64
+// Room for "c<connection>-<sequence>-" and the terminator
+#define BENCH_MIN_SIZE			32
+#define BENCH_RECV_CHUNK		65536
+
+typedef struct bench_options
+{
+	const char *host;
+	const char *port;
+	int connections;
+	int packets;
+	size_t size;
+	double rate;			// packets per second and connection, 0 sends as fast as possible
+	int seek_every;			// every seek_every-th packet is a seek command, 0 never
+	bool session;
+}bench_options_t;
+
+typedef struct bench_thread
+{
+	pthread_t thread;
+	int id;
+	struct addrinfo *server;
+	/**
+	 * Latency of every answered packet in nanoseconds
+	 */
+	uint64_t *latencies;
+	int answered;
+	int errors;
+	int verify_failures;
+	uint64_t bytes_sent;
+	uint64_t bytes_received;
+	/**
+	 * Response being assembled, a session keeps the bytes following the previous response here
+	 */
+	char *response;
+	size_t response_bytes;
+	size_t response_capacity;
+}bench_thread_t;
+
+static bench_options_t options = {
+	.host = BENCH_DEFAULT_HOST,
+	.port = BENCH_DEFAULT_PORT,
+	.connections = BENCH_DEFAULT_CONNECTIONS,
+	.packets = BENCH_DEFAULT_PACKETS,
+	.size = BENCH_DEFAULT_SIZE,
+};
+
+/* Function	: bench_now
+ * Purpose	: CLOCK_MONOTONIC time in nanoseconds
+ */
+static uint64_t bench_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/* Function	: bench_sleep_until
+ * Purpose	: sleep until an absolute CLOCK_MONOTONIC time in nanoseconds
+ */
+static void bench_sleep_until(uint64_t due)
+{
+	struct timespec until = { .tv_sec = due / 1000000000ull, .tv_nsec = due % 1000000000ull };
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR);
+}
+
+/* Function	: bench_connect
+ * Returns	: a connected socket, or -1 on failure
+ */
+static int bench_connect(bench_thread_t *self)
+{
+	int sockfd = socket(self->server->ai_family, self->server->ai_socktype, self->server->ai_protocol);
+	if(sockfd < 0){
+		perror("socket");
+		return -1;
+	}
+	if(connect(sockfd, self->server->ai_addr, self->server->ai_addrlen) < 0){
+		perror("connect");
+		close(sockfd);
+		return -1;
+	}
+	int yes = 1;
+	setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+	return sockfd;
+}
+
+/* Function	: bench_send
+ * Purpose	: send the whole packet
+ * Returns	: 0 on success, -1 on failure
+ */
+static int bench_send(bench_thread_t *self, int sockfd, const char *packet, size_t len)
+{
+	while(len > 0){
+		ssize_t sent = send(sockfd, packet, len, MSG_NOSIGNAL);
+		if(sent < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			perror("send");
+			return -1;
+		}
+		self->bytes_sent += sent;
+		packet += sent;
+		len -= sent;
+	}
+	return 0;
+}
+
+/* Function	: bench_contains_line
+ * Purpose	: whether the response holds line (including its '\n') at the start of one of its lines
+ */
+static bool bench_contains_line(const char *response, size_t response_bytes, const char *line, size_t len)
+{
+	const char *cursor = response;
+	const char *end = response + response_bytes;
+	while((size_t)(end - cursor) >= len){
+		if(memcmp(cursor, line, len) == 0){
+			return true;
+		}
+		const char *newline = memchr(cursor, '\n', end - cursor);
+		if(!newline){
+			break;
+		}
+		cursor = newline + 1;
+	}
+	return false;
+}
+
+/* Function	: bench_response_done
+ * Purpose	: session mode end of response test, see note 3
+ */
+static bool bench_response_done(bench_thread_t *self, const char *packet, size_t len, bool seek)
+{
+	if((self->response_bytes == 0) || (self->response[self->response_bytes - 1] != '\n')){
+		return false;
+	}
+	return seek || bench_contains_line(self->response, self->response_bytes, packet, len);
+}
+
+/* Function	: bench_receive
+ * Purpose	: receive one response, until the server closes the connection or, in a session, until it is complete
+ * Returns	: 0 on success, -1 on failure
+ */
+static int bench_receive(bench_thread_t *self, int sockfd, const char *packet, size_t len, bool seek)
+{
+	while(!options.session || !bench_response_done(self, packet, len, seek)){
+		if(self->response_capacity - self->response_bytes < BENCH_RECV_CHUNK){
+			size_t capacity = self->response_capacity ? self->response_capacity * 2 : 2 * BENCH_RECV_CHUNK;
+			char *grown = realloc(self->response, capacity);
+			if(!grown){
+				return -1;
+			}
+			self->response = grown;
+			self->response_capacity = capacity;
+		}
+		ssize_t received = recv(sockfd, self->response + self->response_bytes, self->response_capacity - self->response_bytes, 0);
+		if(received < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			perror("recv");
+			return -1;
+		}
+		if(received == 0){
+			// End of the response without a session, a session must not be closed by the server
+			return options.session ? -1 : 0;
+		}
+		self->bytes_received += received;
+		self->response_bytes += received;
+	}
+	return 0;
+}
+
+/* Function	: bench_verify
+ * Returns	: true when the response is acceptable for the packet, see note 2
+ */
+static bool bench_verify(bench_thread_t *self, const char *packet, size_t len, bool seek)
+{
+	if((self->response_bytes > 0) && (self->response[self->response_bytes - 1] != '\n')){
+		return false;
+	}
+	return seek || bench_contains_line(self->response, self->response_bytes, packet, len);
+}
+
+/* Function	: bench_format
+ * Purpose	: build packet number seq of this thread
+ * Returns	: true when it is a seek command
+ */
+static bool bench_format(bench_thread_t *self, int seq, char *packet, size_t *len)
+{
+	if((options.seek_every > 0) && (((seq + 1) % options.seek_every) == 0)){
+		*len = snprintf(packet, options.size + 1, "AESDCHAR_IOCSEEKTO:%d,0\n", seq % 10);
+		return true;
+	}
+	int header = snprintf(packet, options.size + 1, "c%d-%d-", self->id, seq);
+	memset(packet + header, 'x', options.size - 1 - header);
+	packet[options.size - 1] = '\n';
+	*len = options.size;
+	return false;
+}
+
+/* Function	: bench_run
+ * Purpose	: body of one client thread
+ */
+static void *bench_run(void *thread_param)
+{
+	bench_thread_t *self = (bench_thread_t *) thread_param;
+	char *packet = malloc(options.size + 1);
+	if(!packet){
+		self->errors = options.packets;
+		return NULL;
+	}
+	int sockfd = -1;
+	uint64_t interval = (options.rate > 0) ? (uint64_t)(1e9 / options.rate) : 0;
+	uint64_t due = bench_now();
+	for(int seq = 0; seq < options.packets; seq++){
+		size_t len;
+		bool seek = bench_format(self, seq, packet, &len);
+		if(interval){
+			bench_sleep_until(due);
+		}
+		else{
+			due = bench_now();
+		}
+		if(!options.session){
+			self->response_bytes = 0;
+		}
+		if(sockfd < 0){
+			sockfd = bench_connect(self);
+		}
+		if((sockfd < 0) || (bench_send(self, sockfd, packet, len) < 0) || (bench_receive(self, sockfd, packet, len, seek) < 0)){
+			self->errors++;
+			if(sockfd >= 0){
+				close(sockfd);
+				sockfd = -1;
+			}
+			self->response_bytes = 0;
+		}
+		else{
+			self->latencies[self->answered++] = bench_now() - due;
+			if(!bench_verify(self, packet, len, seek)){
+				self->verify_failures++;
+			}
+			if(options.session){
+				self->response_bytes = 0;
+			}
+			else{
+				close(sockfd);
+				sockfd = -1;
+			}
+		}
+		due += interval;
+	}
+	if(sockfd >= 0){
+		close(sockfd);
+	}
+	free(packet);
+	return NULL;
+}
+
+/* Function	: bench_compare
+ * Purpose	: qsort() order of latencies
+ */
+static int bench_compare(const void *a, const void *b)
+{
+	uint64_t left = *(const uint64_t *) a;
+	uint64_t right = *(const uint64_t *) b;
+	return (left > right) - (left < right);
+}
+
+/* Function	: bench_percentile
+ * Purpose	: latency below which the fraction q of the sorted samples falls, in microseconds
+ */
+static double bench_percentile(const uint64_t *sorted, size_t count, double q)
+{
+	if(count == 0){
+		return 0.0;
+	}
+	size_t rank = (size_t)(q * count + 0.999999);
+	rank = (rank == 0) ? 1 : rank;
+	return sorted[rank - 1] / 1000.0;
+}
+
+/* Function	: usage
+ * Purpose	: print the accepted command line options
+ */
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-H host] [-p port] [-c connections] [-n packets] [-s size] [-r rate] [-k every] [-S]\n", name);
+	fprintf(stderr, "\t-H\tserver address (default %s)\n", BENCH_DEFAULT_HOST);
+	fprintf(stderr, "\t-p\tserver port (default %s)\n", BENCH_DEFAULT_PORT);
+	fprintf(stderr, "\t-c\tconcurrent connections, one thread each (default %d)\n", BENCH_DEFAULT_CONNECTIONS);
+	fprintf(stderr, "\t-n\tpackets sent by every connection (default %d)\n", BENCH_DEFAULT_PACKETS);
+	fprintf(stderr, "\t-s\tpacket size in bytes including the newline, at least %d (default %d)\n", BENCH_MIN_SIZE, BENCH_DEFAULT_SIZE);
+	fprintf(stderr, "\t-r\tpackets per second and connection, 0 sends as fast as responses come back (default 0)\n");
+	fprintf(stderr, "\t-k\tsend every k-th packet as AESDCHAR_IOCSEEKTO:X,0 (aesdchar backend only)\n");
+	fprintf(stderr, "\t-S\tsend all packets of a connection in one session, the server needs -s\n");
+}
+
+// Driver Function
+int main(int argc, char **argv)
+{
+	int opt;
+	while((opt = getopt(argc, argv, "H:p:c:n:s:r:k:S")) != -1){
+		switch(opt){
+		case 'H':
+			options.host = optarg;
+			break;
+		case 'p':
+			options.port = optarg;
+			break;
+		case 'c':
+			options.connections = atoi(optarg);
+			break;
+		case 'n':
+			options.packets = atoi(optarg);
+			break;
+		case 's':
+			options.size = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			options.rate = atof(optarg);
+			break;
+		case 'k':
+			options.seek_every = atoi(optarg);
+			break;
+		case 'S':
+			options.session = true;
+			break;
+		default:
+			usage(argv[0]);
+			exit(-1);
+		}
+	}
+	if((options.connections < 1) || (options.packets < 1) || (options.size < BENCH_MIN_SIZE) || (options.rate < 0) || (options.seek_every < 0)){
+		usage(argv[0]);
+		exit(-1);
+	}
+
+	struct addrinfo hints;
+	struct addrinfo *server;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	int status = getaddrinfo(options.host, options.port, &hints, &server);
+	if(status != 0){
+		fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(status));
+		exit(-1);
+	}
+
+	bench_thread_t *threads = (bench_thread_t *) calloc(options.connections, sizeof(bench_thread_t));
+	uint64_t *latencies = (uint64_t *) calloc((size_t) options.connections * options.packets, sizeof(uint64_t));
+	if(!threads || !latencies){
+		perror("calloc");
+		exit(-1);
+	}
+	uint64_t started = bench_now();
+	int running = 0;
+	for(int i = 0; i < options.connections; i++){
+		threads[i].id = i;
+		threads[i].server = server;
+		threads[i].latencies = latencies + (size_t) i * options.packets;
+		if(pthread_create(&threads[i].thread, NULL, &bench_run, &threads[i]) != 0){
+			perror("pthread_create");
+			break;
+		}
+		running++;
+	}
+	for(int i = 0; i < running; i++){
+		pthread_join(threads[i].thread, NULL);
+	}
+	double elapsed = (bench_now() - started) / 1e9;
+
+	// Pack the samples of all threads together for sorting
+	size_t answered = 0;
+	int errors = 0;
+	int verify_failures = 0;
+	uint64_t bytes_sent = 0;
+	uint64_t bytes_received = 0;
+	for(int i = 0; i < running; i++){
+		memmove(latencies + answered, threads[i].latencies, threads[i].answered * sizeof(uint64_t));
+		answered += threads[i].answered;
+		errors += threads[i].errors;
+		verify_failures += threads[i].verify_failures;
+		bytes_sent += threads[i].bytes_sent;
+		bytes_received += threads[i].bytes_received;
+		free(threads[i].response);
+	}
+	qsort(latencies, answered, sizeof(uint64_t), &bench_compare);
+
+	printf("connections %d packets %d size %zu session %s\n", running, options.packets, options.size, options.session ? "yes" : "no");
+	printf("answered %zu errors %d verify_failures %d elapsed %.3f s\n", answered, errors, verify_failures, elapsed);
+	printf("throughput %.1f packets/s, sent %.3f MB/s, received %.3f MB/s\n", answered / elapsed,
+		bytes_sent / elapsed / 1e6, bytes_received / elapsed / 1e6);
+	printf("latency_us p50=%.1f p99=%.1f p99.9=%.1f max=%.1f\n", bench_percentile(latencies, answered, 0.5),
+		bench_percentile(latencies, answered, 0.99), bench_percentile(latencies, answered, 0.999),
+		answered ? latencies[answered - 1] / 1000.0 : 0.0);
+
+	free(latencies);
+	free(threads);
+	freeaddrinfo(server);
+	return ((errors > 0) || (verify_failures > 0) || (running < options.connections)) ? 1 : 0;
+}
@@ -1,18 +1,29 @@
 #! /bin/sh
 
+# A server started with this socket hands its listeners to the next one started with it, see aesd-drain.h
+HANDOFF=/var/run/aesdsocket.handoff
+# Seconds a stopping server gets to finish its connections, a little more than its drain deadline (-D)
+DRAIN_WAIT=35
+
 case "$1" in
   start)
   	echo "Starting simpleserver"
-  	start-stop-daemon -S -n aesdsocket -a /usr/bin/aesdsocket -- -d
+  	start-stop-daemon -S -n aesdsocket -a /usr/bin/aesdsocket -- -d -R $HANDOFF
   	/usr/bin/aesdchar_load
   	;;
   stop)
-    	echo "Starting simpLeserver"
-  	start-stop-daemon -K -n aesdsocket
+  	echo "Stopping simpleserver"
+  	# SIGTERM drains, SIGKILL only if the server is still there after the drain
+  	start-stop-daemon -K -n aesdsocket --retry TERM/$DRAIN_WAIT/KILL/5
   	/usr/bin/aesdchar_unload
   	;;
+  restart)
+  	echo "Restarting simpleserver"
+  	# The new binary takes the listeners over, the running one drains and exits, no connection is refused
+  	/usr/bin/aesdsocket -d -R $HANDOFF
+  	;;
   *)
-  	echo "Usage: $0 {start|stop}"
+  	echo "Usage: $0 {start|stop|restart}"
   exit 1
 esac
 
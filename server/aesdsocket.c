@@ -11,8 +11,11 @@
    			2.	These values are sent to AESDCHAR_SEEKTO ioctl
    				Then IOCTL command will perform before writes to device
    			3.	Read file and return to socket uses same file descriptor used to send to ioctl. So that file offset is honored read command.
+   			4.	AESDCHAR_IOCRANGE:X,Y,N returns only N write commands starting at offset Y of write command X, and
+   				AESDCHAR_IOCRANGEBYTES:X,Y,L only L bytes from there, instead of everything up to the end.
 */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
@@ -22,44 +25,48 @@
 #include <signal.h>
 #include <fcntl.h>
 #include <stdbool.h>
-#include <syslog.h>
 #include <net/if.h>
 #include <sys/stat.h>
 #include <string.h>
-#include <sys/queue.h>
 #include <pthread.h>
+#include <sched.h>
 #include <sys/time.h>
 #include <arpa/inet.h>
 #include <signal.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <string.h>
+#include <sys/sendfile.h>
+#include <sys/timerfd.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <ctype.h>
+#include <limits.h>
 #include <netdb.h>
-#include "../aesd-char-driver/aesd_ioctl.h"
-#define USE_AESD_CHAR_DEVICE 1
+#include "aesdsocket.h"
+#include "aesd-store.h"
+#include "aesd-rxbuf.h"
+#include "aesd-pool.h"
+#include "aesd-commit.h"
+#include "aesd-metrics.h"
+#include "aesd-snapshot.h"
+#include "aesd-subscribe.h"
+#include "aesd-log.h"
+#include "aesd-outq.h"
+#include "aesd-drain.h"
 #define TIMESTAMP_SIZE 100
-#ifdef USE_AESD_CHAR_DEVICE
-	#define STORE_IN_THIS_FILE ("/dev/aesdchar")
-	const char *perform_ioctl = "AESDCHAR_IOCSEEKTO:";
-#else
-	#define STORE_IN_THIS_FILE ("/var/tmp/aesdsocketdata")
-#endif
+// Seconds between timestamps on backends which take them, assignment 9 keeps them out of /dev/aesdchar
+#define TIMESTAMP_DEFAULT_INTERVAL 10
+const char *perform_ioctl = "AESDCHAR_IOCSEEKTO:";
+const char *perform_range = "AESDCHAR_IOCRANGE:";
+const char *perform_range_bytes = "AESDCHAR_IOCRANGEBYTES:";
 
-int fd;
+// Handle used by the timestamp writer, connections open their own through open_store()
+aesd_store_t timestamp_store;
 int sockfd;
 pthread_mutex_t mutex_lock;
-// To perform multithreaded applications, 
-typedef struct node
-{
-	pthread_t thread;
-	int clientfd;
-	bool thread_complete_status;
-	char client_ipaddress[INET6_ADDRSTRLEN];
-	TAILQ_ENTRY(node) entries;
-}thread_data_t;
-
-typedef TAILQ_HEAD(head_s, node) head_t;
-head_t head;
+aesd_config_t config;
 // Assignment instruction 2b - Append timestamp in 24hours format
 // parameters 	: 	None
 // Returns    	:	None
@@ -67,171 +74,904 @@ head_t head;
 void append_time_stamp()
 {
 	time_t t;
-	struct tm *tmp;
+	struct tm tmp;
 	char MY_TIME[TIMESTAMP_SIZE];
 	time(&t);
-	tmp = localtime(&t);
-	strftime(MY_TIME, sizeof(MY_TIME), "timestamp: %Y-%m-%d %H:%M:%S\r\n", tmp);
-	printf("%s", MY_TIME);
-	lseek(fd, 0, SEEK_END);						// Move the current file to the end
-	int write_bytes_count = write(fd, MY_TIME, strlen(MY_TIME));
-	if (write_bytes_count != strlen(MY_TIME)) {
-		printf("write unsuccessful\n");
+	localtime_r(&t, &tmp);
+	size_t time_bytes = strftime(MY_TIME, sizeof(MY_TIME), "timestamp: %Y-%m-%d %H:%M:%S\r\n", &tmp);
+	AESD_LOG(LOG_DEBUG, "%.*s", (int) strcspn(MY_TIME, "\r\n"), MY_TIME);
+	// Same ordered path as a client packet, so a timestamp never lands in the middle of one
+	if (store_append(&timestamp_store, MY_TIME, time_bytes) < 0) {
+		AESD_LOG(LOG_ERR, "write unsuccessful");
+	}
+}
+/* Function	: timestamp_thread
+ * Purpose	: append a timestamp every config.timestamp_interval seconds. The period comes from a timerfd, so no
+ *		  signal interrupts the threads serving connections and a late wakeup does not shift the next ones.
+ */
+static void *timestamp_thread(void *thread_param)
+{
+	int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (timer_fd < 0) {
+		perror("timerfd_create");
+		return NULL;
+	}
+	struct itimerspec period = {
+		.it_interval = { .tv_sec = config.timestamp_interval },
+		.it_value = { .tv_sec = config.timestamp_interval },
+	};
+	if (timerfd_settime(timer_fd, 0, &period, NULL) < 0) {
+		perror("timerfd_settime");
+		close(timer_fd);
+		return NULL;
+	}
+	while (1) {
+		uint64_t expirations;
+		if (read(timer_fd, &expirations, sizeof(expirations)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("timerfd read");
+			break;
+		}
+		// Periods missed while the store was busy are collapsed into a single timestamp
+		append_time_stamp();
 	}
+	close(timer_fd);
+	return thread_param;
 }
 // Remove all the memory to avoid memory leaks from valgrind checks, in this program, that occurs only during SIGINT, SIGTERM
-// queue.h functions handbook line 187 - 192
+// Connections waiting in the worker pool queue are held by value, nothing is allocated per connection anymore
 void delete_all_the_memory()
 {
-	thread_data_t *datap;
-	while(!TAILQ_EMPTY(&head))
-	{
-		datap = TAILQ_FIRST(&head);
-		TAILQ_REMOVE(&head, datap, entries);
-		free(datap);
-	}
 	pthread_mutex_destroy(&mutex_lock);
 }
-// Signal handler function to terminate during SIGINT and SIGTERM and add timestamp every 10 seconds
-void signal_handler(int signo)
+// Release everything and exit, see aesdsocket.h
+void aesd_exit(void)
 {
-	printf("%d signal caught", signo);
-	// Call timestamp every 10 seconds despite other operations happening in parallel, discussed in robert love linux system programming chapter 10, Page 387
-	if (signo == SIGALRM)
-	{
-		printf("SIGALRM ALERT\n");
-		#ifndef USE_AESD_CHAR_DEVICE
-			append_time_stamp();
-		#endif
-		alarm(10);
+	close_store(&timestamp_store);
+	close(sockfd);
+	// After a handoff the new server goes on with the same store file and admin socket
+	if (!aesd_drain_handed_off()) {
+		if (config.backend->path) {
+			remove(config.backend->path);
+		}
+		if (config.admin_socket) {
+			unlink(config.admin_socket);
+		}
+		if (config.handoff_socket) {
+			unlink(config.handoff_socket);
+		}
 	}
+	delete_all_the_memory();
+	aesd_log_flush();
+	exit (0);
+}
+// Signal handler function to terminate during SIGINT and SIGTERM, timestamps are written by timestamp_thread
+void signal_handler(int signo)
+{
 	// In case a SIGINT or SIGTERM happens (pressing ctrl + c, graceful cleanup operation)
 	// Perform program exit - As per assignment instructions 1.c
 	if ((signo == SIGINT) || (signo == SIGTERM)) {
-		printf("Caught signal %d\n", signo);
-		close(fd);
-		close(sockfd);
-		remove(STORE_IN_THIS_FILE);
-		delete_all_the_memory();
-		exit (0);
+		// Logging and cleanup are not async signal safe, the drain thread drains or exits for the handler
+		if (!aesd_drain_request(signo)) {
+			_exit(EXIT_FAILURE);
+		}
 	}
 }
-// Perform threading function which we will be handling upon every connection.
-void * thread_function(void* thread_param)
+// Open the store for a single connection, see aesdsocket.h
+int open_store(aesd_store_t *store)
 {
-	thread_data_t* data = (thread_data_t *)thread_param;
-	bool packet_in_progress = true;
-	bool need_to_realloc = false;
-	char read_data, write_data;
-	char *write_buffer = (char*)malloc(sizeof(char));
-	int current_bytes = 0;
-	data->thread_complete_status=false;
-	fd = open(STORE_IN_THIS_FILE,O_RDWR|O_CREAT|O_APPEND, 0777);
-	if(fd < 0){
-		perror("Unable to open the file");
-	}
-	while(packet_in_progress)
-	{
-		if(need_to_realloc)
-		{
-			write_buffer = realloc(write_buffer, current_bytes+1);
-			need_to_realloc = false;
+	memset(store, 0, sizeof(aesd_store_t));
+	store->fd = -1;
+	store->end = -1;
+	store->backend = config.backend;
+	if(store->backend->open(store) < 0){
+		store->backend = NULL;
+		return -1;
+	}
+	return 0;
+}
+// Close a store handle, see aesdsocket.h
+void close_store(aesd_store_t *store)
+{
+	if(store->backend){
+		store->backend->close(store);
+		store->backend = NULL;
+	}
+}
+/* Function	: store_seek_frame
+ * Purpose	: store_seek() of the read frames, their arguments are binary and need no parsing
+ */
+static int store_seek_frame(aesd_store_t *store, uint8_t opcode, const char *packet, size_t len)
+{
+	if((opcode == AESD_OP_SEEK_READ) && (len == 2 * sizeof(uint32_t))){
+		if(!store->backend->seek){
+			errno = EOPNOTSUPP;
+			return -1;
 		}
-		int receive_bytes = recv(data->clientfd, &write_data, 1, 0);
-		if(receive_bytes < 1)
-		{
-			printf("Error receiving bytes\n");
-			perror("recv error\n");
+		return (store->backend->seek(store, aesd_frame_u32(packet), aesd_frame_u32(packet + 4), 0) < 0) ? -1 : 1;
+	}
+	if((opcode == AESD_OP_ENTRY_READ) && (len == 3 * sizeof(uint32_t))){
+		unsigned int write_cmd_count = aesd_frame_u32(packet + 8);
+		if(!store->backend->seek || (write_cmd_count == 0)){
+			errno = store->backend->seek ? EINVAL : EOPNOTSUPP;
+			return -1;
 		}
-		if(receive_bytes == 1)
-		{
-			need_to_realloc = true;
-			*(write_buffer + current_bytes) = write_data;
-			current_bytes++;
+		return (store->backend->seek(store, aesd_frame_u32(packet), aesd_frame_u32(packet + 4), write_cmd_count) < 0) ? -1 : 1;
+	}
+	if((opcode == AESD_OP_RANGE_READ) && (len == 2 * sizeof(uint64_t))){
+		uint64_t offset = aesd_frame_u64(packet);
+		uint64_t length = aesd_frame_u64(packet + 8);
+		if((offset > INT64_MAX) || (length > INT64_MAX - offset)){
+			errno = EINVAL;
+			return -1;
 		}
-		if(write_data == '\n')
-		{
-			packet_in_progress = false;
+		store->pos = offset;
+		store->end = offset + length;
+		return 1;
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+/* Function	: store_seek_arguments
+ * Purpose	: parse the count comma separated decimal numbers of a text command, within len bytes. The packet is a
+ *		  slice of the receive buffer without a terminating NUL, so it can not go to sscanf().
+ * Parameters	: the arguments behind the colon and their length, the numbers to fill and the largest value of each
+ * Returns	: 0 on success, -1 when the arguments are malformed or a number is out of range
+ */
+static int store_seek_arguments(const char *args, size_t len, unsigned long long *numbers, const unsigned long long *maxima, int count)
+{
+	size_t i = 0;
+	for(int n = 0; n < count; n++){
+		if((n > 0) && ((i >= len) || (args[i++] != ','))){
+			return -1;
+		}
+		size_t first = i;
+		numbers[n] = 0;
+		while((i < len) && isdigit((unsigned char) args[i])){
+			unsigned int digit = args[i++] - '0';
+			if(numbers[n] > (maxima[n] - digit) / 10){
+				return -1;
+			}
+			numbers[n] = numbers[n] * 10 + digit;
+		}
+		if(i == first){
+			return -1;
 		}
 	}
+	// Only the line ending may follow
+	while((i < len) && isspace((unsigned char) args[i])){
+		i++;
+	}
+	return (i == len) ? 0 : -1;
+}
+
+// Handle a read command, see aesdsocket.h
+int store_seek(aesd_store_t *store, uint8_t opcode, const char *packet, size_t len)
+{
+	store->end = -1;
+	if(opcode == AESD_OP_WRITE){
+		return 0;
+	}
+	if(opcode != AESD_OP_TEXT){
+		return store_seek_frame(store, opcode, packet, len);
+	}
    	/*	1.	String sent to Socket AESDCHAR_IOCSEEKTO:X,Y where X and Y are unsigned decimal integer values.
 			X - Write Command to seek into, Y - Offset within write command
 		2.	These values are sent to AESDCHAR_SEEKTO ioctl
 			Then IOCTL command will perform before writes to device
-		3.	Read file and return to socket uses same file descriptor used to send to ioctl. So that file offset is honored read command.*/
-	if(strncmp(write_buffer, perform_ioctl, strlen(perform_ioctl)) == 0) {
-        	struct aesd_seekto seekto;
-        	sscanf(write_buffer, "AESDCHAR_IOCSEEKTO:%d,%d", &seekto.write_cmd, &seekto.write_cmd_offset);
-        	if(ioctl(fd, AESDCHAR_IOCSEEKTO, &seekto)) {
-            		perror("ioctl failed.");
+		3.	The response is read from the position the backend returned, on the handle of this connection.
+		4.	AESDCHAR_IOCRANGE:X,Y,N seeks the same way but the response stops behind N write commands, and
+			AESDCHAR_IOCRANGEBYTES:X,Y,L stops after L bytes.
+		A backend without packet boundaries (the file) has no seek and stores the command as data.*/
+	if(!store->backend->seek){
+		return 0;
+	}
+	// X and Y (and N) are unsigned ints, the byte length L is 64 bit
+	static const unsigned long long maxima[] = { UINT_MAX, UINT_MAX, UINT_MAX };
+	static const unsigned long long maxima_bytes[] = { UINT_MAX, UINT_MAX, ULLONG_MAX };
+	unsigned long long arguments[3];
+	size_t prefix = strlen(perform_ioctl);
+	if((len >= prefix) && (strncmp(packet, perform_ioctl, prefix) == 0)) {
+        	if(store_seek_arguments(packet + prefix, len - prefix, arguments, maxima, 2) < 0) {
+        		return -1;
         	}
+        	if(store->backend->seek(store, arguments[0], arguments[1], 0) < 0) {
+            		return -1;
+        	}
+        	return 1;
     	}
-    	else{
+	prefix = strlen(perform_range);
+	if((len >= prefix) && (strncmp(packet, perform_range, prefix) == 0)) {
+		if((store_seek_arguments(packet + prefix, len - prefix, arguments, maxima, 3) < 0) || (arguments[2] == 0)) {
+			return -1;
+		}
+		if(store->backend->seek(store, arguments[0], arguments[1], arguments[2]) < 0) {
+			return -1;
+		}
+		return 1;
+	}
+	prefix = strlen(perform_range_bytes);
+	if((len >= prefix) && (strncmp(packet, perform_range_bytes, prefix) == 0)) {
+		if(store_seek_arguments(packet + prefix, len - prefix, arguments, maxima_bytes, 3) < 0) {
+			return -1;
+		}
+		if(store->backend->seek(store, arguments[0], arguments[1], 0) < 0) {
+			return -1;
+		}
+		store->end = (arguments[2] > (unsigned long long)(INT64_MAX - store->pos)) ? -1 : store->pos + (off_t) arguments[2];
+		return 1;
+	}
+	return 0;
+}
+// Append data to the store in order with all other writers, see aesdsocket.h
+int store_append(aesd_store_t *store, const char *data, size_t len)
+{
+	if(config.group_commit){
+		// The committer writes this packet together with the ones of other connections
+		return aesd_commit_write(data, len);
+	}
+	uint64_t started = aesd_metrics_now();
 	// Lock the program to prevent mutual sharing of resources by multiple threads simoultaneously
-	pthread_mutex_lock(&mutex_lock);
-	int write_bytes = write(fd, write_buffer, current_bytes);
-	if(write_bytes != current_bytes){
-		perror("write failed\n");
+	aesd_metrics_lock(&mutex_lock);
+	struct iovec packet = { .iov_base = (void *) data, .iov_len = len };
+	int status = store->backend->append(store, &packet, 1);
+	aesd_snapshot_bump();
+	if(status == 0){
+		// append() may have moved the iovec
+		struct iovec published = { .iov_base = (void *) data, .iov_len = len };
+		aesd_subscribe_publish(&published, 1);
 	}
-	printf("write success\n");
 	// Once the process is complete, perform unlock for the data to be available the next time.
 	pthread_mutex_unlock(&mutex_lock);
+	aesd_metrics_record(AESD_METRIC_STORE_WRITE, started);
+	if(status < 0){
+		perror("write failed\n");
+		return -1;
 	}
-	while(read(fd, &read_data, 1) != 0) {
-	// Lock the program to prevent mutual sharing of resources by multiple threads simoultaneously
-	pthread_mutex_lock(&mutex_lock);
-	int sent_status = send(data->clientfd, &read_data, 1, 0);
-	if (sent_status == 0)
+	return 0;
+}
+// Apply one received packet to the store, see aesdsocket.h
+int store_packet(aesd_store_t *store, uint8_t opcode, const char *packet, size_t len)
+{
+	int seek_status = store_seek(store, opcode, packet, len);
+	if(seek_status != 0){
+		return (seek_status < 0) ? -1 : 0;
+	}
+	if(store_append(store, packet, len) < 0){
+		return -1;
+	}
+	AESD_LOG(LOG_DEBUG, "write success");
+	// The whole store is sent back after a write
+	store->pos = 0;
+	return 0;
+}
+// Whether sendfile() works on the store, it is a property of the store so it is probed once for all connections
+enum { STORE_SPLICE_UNKNOWN, STORE_SPLICE_YES, STORE_SPLICE_NO };
+static atomic_int store_splice = STORE_SPLICE_UNKNOWN;
+
+// Bytes the next read of the response may return, see aesdsocket.h
+size_t store_stream_limit(const aesd_store_t *store)
+{
+	if(store->end < 0){
+		return STORE_STREAM_CHUNK;
+	}
+	if(store->pos >= store->end){
+		return 0;
+	}
+	return ((store->end - store->pos) < STORE_STREAM_CHUNK) ? (size_t)(store->end - store->pos) : STORE_STREAM_CHUNK;
+}
+
+// Prepare the response stream state, see aesdsocket.h
+void store_stream_init(store_stream_t *stream)
+{
+	memset(stream, 0, sizeof(store_stream_t));
+}
+
+// Release the response stream state, see aesdsocket.h
+void store_stream_free(store_stream_t *stream)
+{
+	if(!aesd_arena_owns(stream->arena, stream->bounce)){
+		free(stream->bounce);
+	}
+	aesd_snapshot_put(stream->snapshot);
+	store_stream_init(stream);
+}
+
+// Allocate the bounce buffer, see aesdsocket.h
+int store_stream_bounce(store_stream_t *stream)
+{
+	if(stream->bounce){
+		return 0;
+	}
+	size_t size = AESD_FRAME_HEADER_SIZE + STORE_STREAM_CHUNK;
+	stream->bounce = stream->arena ? aesd_arena_alloc(stream->arena, size) : NULL;
+	if(!stream->bounce){
+		if(stream->arena){
+			aesd_arena_overflow();
+		}
+		stream->bounce = malloc(size);
+	}
+	return stream->bounce ? 0 : -1;
+}
+
+/* Function	: store_stream_snapshot
+ * Purpose	: store_stream_send() from the cached snapshot, the snapshot is dropped once the response is done
+ */
+static int store_stream_snapshot(store_stream_t *stream, aesd_store_t *store, int clientfd)
+{
+	if(!stream->snapshot){
+		stream->snapshot = aesd_snapshot_get(store);
+		if(!stream->snapshot){
+			return -1;
+		}
+	}
+	size_t len = stream->snapshot->len;
+	if((store->end >= 0) && ((size_t) store->end < len)){
+		len = store->end;
+	}
+	int status = 1;
+	while((size_t) store->pos < len){
+		ssize_t sent = send(clientfd, stream->snapshot->data + store->pos, len - store->pos, MSG_NOSIGNAL);
+		if(sent < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			if((errno == EAGAIN) || (errno == EWOULDBLOCK)){
+				return 0;
+			}
+			status = -1;
+			break;
+		}
+		aesd_metrics_add(AESD_METRIC_BYTES_OUT, sent);
+		stream->sent += sent;
+		store->pos += sent;
+	}
+	aesd_snapshot_put(stream->snapshot);
+	stream->snapshot = NULL;
+	return status;
+}
+
+/* Function	: store_stream_end
+ * Purpose	: the whole window is sent, queue the empty frame ending a framed response
+ * Returns	: 1 when the response is complete, 0 when the trailer was queued and has to be sent, -1 on failure
+ */
+static int store_stream_end(store_stream_t *stream)
+{
+	if(!stream->framed){
+		return 1;
+	}
+	if(store_stream_bounce(stream) < 0){
+		return -1;
+	}
+	aesd_frame_header(stream->bounce, AESD_OP_DATA, 0);
+	stream->bounce_bytes = AESD_FRAME_HEADER_SIZE;
+	stream->bounce_sent = 0;
+	stream->trailer = true;
+	return 0;
+}
+
+// Send the store to the client, see aesdsocket.h
+int store_stream_send(store_stream_t *stream, aesd_store_t *store, int clientfd)
+{
+	if(config.snapshot_cache && !stream->framed){
+		return store_stream_snapshot(stream, store, clientfd);
+	}
+	while(1){
+		// Finish a chunk which was copied to the bounce buffer before
+		if(stream->bounce_sent < stream->bounce_bytes){
+			ssize_t sent = send(clientfd, stream->bounce + stream->bounce_sent, stream->bounce_bytes - stream->bounce_sent, MSG_NOSIGNAL);
+			if(sent < 0){
+				if(errno == EINTR){
+					continue;
+				}
+				return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -1;
+			}
+			aesd_metrics_add(AESD_METRIC_BYTES_OUT, sent);
+			stream->bounce_sent += sent;
+			stream->sent += sent;
+			continue;
+		}
+		if(stream->trailer){
+			stream->trailer = false;
+			return 1;
+		}
+		size_t limit = store_stream_limit(store);
+		if(limit == 0){
+			int status = store_stream_end(stream);
+			if(status != 0){
+				return status;
+			}
+			continue;
+		}
+		if(!stream->framed && store->backend->fd_backed && (atomic_load(&store_splice) != STORE_SPLICE_NO)){
+			ssize_t sent = sendfile(clientfd, store->fd, &store->pos, limit);
+			if(sent > 0){
+				aesd_metrics_add(AESD_METRIC_BYTES_OUT, sent);
+				stream->sent += sent;
+				atomic_store(&store_splice, STORE_SPLICE_YES);
+				continue;
+			}
+			if(sent == 0){
+				return 1;
+			}
+			if(errno == EINTR){
+				continue;
+			}
+			if((errno == EAGAIN) || (errno == EWOULDBLOCK)){
+				return 0;
+			}
+			if(((errno != EINVAL) && (errno != ENOSYS) && (errno != EOPNOTSUPP)) || (atomic_load(&store_splice) == STORE_SPLICE_YES)){
+				perror("sendfile failed");
+				return -1;
+			}
+			AESD_LOG(LOG_DEBUG, "Store can not be spliced, falling back to buffered responses");
+			atomic_store(&store_splice, STORE_SPLICE_NO);
+		}
+		if(store_stream_bounce(stream) < 0){
+			return -1;
+		}
+		// A framed chunk is read in behind the room for its header
+		size_t header = stream->framed ? AESD_FRAME_HEADER_SIZE : 0;
+		// Reads may come back short (drivers before multi-entry reads return one packet each), fill the chunk so a
+		// bounded window leaves in one send
+		ssize_t read_bytes = 0;
+		while((size_t) read_bytes < limit){
+			ssize_t chunk = store->backend->read(store, stream->bounce + header + read_bytes, limit - read_bytes, store->pos + read_bytes);
+			if(chunk < 0){
+				perror("read failed");
+				return -1;
+			}
+			if(chunk == 0){
+				break;
+			}
+			read_bytes += chunk;
+		}
+		if(read_bytes == 0){
+			int status = store_stream_end(stream);
+			if(status != 0){
+				return status;
+			}
+			continue;
+		}
+		if(stream->framed){
+			aesd_frame_header(stream->bounce, AESD_OP_DATA, read_bytes);
+		}
+		store->pos += read_bytes;
+		stream->bounce_bytes = header + read_bytes;
+		stream->bounce_sent = 0;
+	}
+}
+// Handle one connection on a worker thread of the pool, called for every connection the acceptor queued.
+void serve_connection(aesd_client_t *data)
+{
+	store_stream_t stream;
+	const char *packet = NULL;
+	size_t packet_bytes = 0;
+	aesd_rxbuf_t rx;
+	// Buffers of the connection come from one recycled arena, NULL falls back to malloc()
+	aesd_arena_t *arena = aesd_arena_get();
+	aesd_rxbuf_init(&rx);
+	rx.accepted_at = data->accepted_at;
+	rx.arena = arena;
+	store_stream_init(&stream);
+	stream.arena = arena;
+	aesd_store_t store;
+	bool session_open = (open_store(&store) == 0);
+	bool subscribed = false;
+	// In session mode a client which stays silent for session_timeout seconds is disconnected
+	if(config.session_timeout > 0)
 	{
-		printf("send failed\n");
+		struct timeval idle = { .tv_sec = config.session_timeout, .tv_usec = 0 };
+		setsockopt(data->clientfd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
 	}
-	// Once the process is complete, perform unlock for the data to be available the next time.
-	pthread_mutex_unlock(&mutex_lock);
-    }
-	printf("send complete\n");
-	packet_in_progress = true;
-	//Once the packet is transmitter, close the socket and open the socket on the next thread execution
-	int close_fd = close(data->clientfd);
-	if(close_fd == 0){
-		syslog(LOG_DEBUG, "Closed connection from %s\n", data->client_ipaddress);
-	}
-	current_bytes = 0;
-	free(write_buffer);
-	data->thread_complete_status=true;
+	while(session_open)
+	{
+		// Receive in large chunks until the packet terminator shows up
+		while(!aesd_rxbuf_next_packet(&rx, &packet, &packet_bytes))
+		{
+			ssize_t receive_bytes = aesd_rxbuf_recv(&rx, data->clientfd);
+			if(receive_bytes < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if(receive_bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			{
+				AESD_LOG(LOG_DEBUG, "Idle session from %s timed out", data->client_ipaddress);
+				packet = NULL;
+				break;
+			}
+			if(receive_bytes < 1)
+			{
+				// The peer closing its session between two packets is the normal end of a session
+				if(receive_bytes < 0 || aesd_rxbuf_pending(&rx) > 0)
+				{
+					AESD_LOG(LOG_ERR, "Error receiving bytes from %s", data->client_ipaddress);
+					perror("recv error\n");
+				}
+				packet = NULL;
+				break;
+			}
+		}
+		if(!packet)
+		{
+			break;
+		}
+		if((rx.opcode == AESD_OP_TEXT) && aesd_subscribe_command(packet, packet_bytes))
+		{
+			// The subscription thread owns the socket from here on
+			subscribed = (aesd_subscribe_add(data->clientfd, data->client_ipaddress) == 0);
+			break;
+		}
+		if((store_packet(&store, rx.opcode, packet, packet_bytes) < 0) && (rx.opcode != AESD_OP_TEXT))
+		{
+			// A frame which could not be carried out gets no response, the client sees the close instead
+			break;
+		}
+		stream.framed = (rx.framing == AESD_FRAMING_BINARY);
+		// Stream the whole store back in large steps, the store is not locked while the client reads it
+		uint64_t send_started = aesd_metrics_now();
+		if(store_stream_send(&stream, &store, data->clientfd) < 0)
+		{
+			AESD_LOG(LOG_ERR, "send failed");
+			break;
+		}
+		aesd_metrics_record(AESD_METRIC_SEND, send_started);
+		AESD_LOG(LOG_DEBUG, "send complete");
+		// Without a session every connection carries exactly one packet
+		session_open = (config.session_timeout > 0);
+	}
+	//Once the packet is transmitted, close the socket and let the worker pick the next queued connection
+	if(!subscribed)
+	{
+		int close_fd = close(data->clientfd);
+		if(close_fd == 0){
+			AESD_LOG(LOG_DEBUG, "Closed connection from %s", data->client_ipaddress);
+		}
+		aesd_metrics_add(AESD_METRIC_CONNECTIONS_CLOSED, 1);
+	}
+	close_store(&store);
+	aesd_rxbuf_free(&rx);
+	store_stream_free(&stream);
+	aesd_arena_put(arena);
+}
+// One accept() loop of the thread engine, all of them feed the same worker pool
+typedef struct acceptor
+{
+	pthread_t thread;
+	int sockfd;
+	aesd_pool_t *pool;
+}acceptor_t;
+
+/* Function	: accept_connections
+ * Purpose	: accept connections on one listener and queue them for the worker pool, runs until accept() fails
+ */
+static void *accept_connections(void *thread_param)
+{
+	acceptor_t *acceptor = (acceptor_t *) thread_param;
+	struct sockaddr_in clientadd;
+	socklen_t clientlen;
+	while (1) {
+		// Back-pressure: while every queue slot is taken, connections wait in the kernel backlog
+		aesd_pool_reserve(acceptor->pool);
+		// Wait for a connection or for a drain, which leaves the listener to the drain thread
+		struct pollfd ready[2] = {
+			{ .fd = acceptor->sockfd, .events = POLLIN },
+			{ .fd = aesd_drain_fd(), .events = POLLIN },
+		};
+		int polled = poll(ready, 2, -1);
+		if (ready[1].revents & POLLIN) {
+			aesd_pool_unreserve(acceptor->pool);
+			break;
+		}
+		aesd_client_t client;
+		clientlen = sizeof(clientadd);
+		// A listener taken over from an epoll server is non-blocking, another process may also win the connection
+		client.clientfd = (polled < 0) ? -1 : accept(acceptor->sockfd, (struct sockaddr *) &clientadd, &clientlen);
+		client.accepted_at = aesd_metrics_now();
+
+		if (client.clientfd == -1) {
+			aesd_pool_unreserve(acceptor->pool);
+			if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN || errno == EWOULDBLOCK) {
+				continue;
+			}
+			perror("Error in accepting\n");
+			break;
+		}
+		// Convert IPv4 and IPv6 address from binary to text form
+		inet_ntop(clientadd.sin_family, &clientadd.sin_addr, client.client_ipaddress, sizeof(client.client_ipaddress));
+		AESD_LOG(LOG_DEBUG, "Accepted a connection from %s", client.client_ipaddress);
+		aesd_metrics_add(AESD_METRIC_CONNECTIONS_OPENED, 1);
+		// Once successful connection accept, hand it to the next idle worker
+		aesd_pool_submit(acceptor->pool, &client);
+	}
+	aesd_drain_leave();
 	return thread_param;
 }
-// Driver Function
-int main(int argc, char **argv) {
-/************************************************************************************************Signal Handler Invoke********************************************************************************/
-	signal(SIGINT, signal_handler);
-	signal(SIGTERM, signal_handler);
-	signal(SIGALRM, signal_handler);
-/*************************************************************************************************** Create the Socket *******************************************************************************/
-	syslog(LOG_USER, "Socket Creation");
-	sockfd = socket(AF_INET,SOCK_STREAM,0);
-	if(sockfd == -1){
-   		perror("Socket Not created Properly");
-   		exit(-1);
-	}
-/*************************************************************************************************** Bind the Socket *********************************************************************************/
+
+/* Function	: open_listener
+ * Purpose	: create a TCP socket bound to port 9000. With reuseport several such sockets share the port and the
+ *		  kernel spreads incoming connections over them by hashing the connection's addresses.
+ * Returns	: the socket, or -1 on failure
+ */
+static int open_listener(bool reuseport)
+{
+	AESD_LOG(LOG_INFO, "Socket Creation");
+	int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(listen_fd == -1){
+		perror("Socket Not created Properly");
+		return -1;
+	}
 	struct sockaddr_in server;
 	memset((void *)&server, 0, sizeof(server));
 	server.sin_family = AF_INET;
 	server.sin_addr.s_addr = INADDR_ANY;
 	server.sin_port = htons(9000);
-/***************************************************************************************** Bind the client with the server ***************************************************************************/
 	int yes = 1;
-	if(setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) == -1){
+	if(setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) == -1){
 		perror("Unable to Setup reusing ability of the socket port and ip");
-		exit(1);
+		close(listen_fd);
+		return -1;
+	}
+	if(reuseport && (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == -1)){
+		perror("Unable to share the port between listeners");
+		close(listen_fd);
+		return -1;
 	}
-	
-	int sockbind = bind(sockfd, (struct sockaddr *)&server, sizeof(server));
-	if(sockbind == -1){
-		close(sockfd);
+	if(bind(listen_fd, (struct sockaddr *)&server, sizeof(server)) == -1){
 		perror("Unable to bind Properly");
+		close(listen_fd);
+		return -1;
+	}
+	return listen_fd;
+}
+
+// Pin a thread to a CPU, see aesdsocket.h
+void aesd_set_affinity(pthread_t thread, int index)
+{
+	if(!config.cpu_affinity){
+		return;
+	}
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	cpu_set_t cpu;
+	CPU_ZERO(&cpu);
+	CPU_SET(index % ((cpus > 0) ? cpus : 1), &cpu);
+	int status = pthread_setaffinity_np(thread, sizeof(cpu), &cpu);
+	if(status != 0){
+		errno = status;
+		perror("pthread_setaffinity_np");
 	}
-	syslog(LOG_USER, "Binded Connection from 9000");
+}
+
+/* Function	: usage
+ * Purpose	: print the accepted command line options
+ */
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-d] [-m thread|epoll|uring] [-t threads] [-w workers] [-q depth] [-s seconds] [-g] [-i seconds] [-a path] [-l listeners] [-b backlog] [-A] [-B device|file|memory] [-C] [-u bytes] [-U drop|disconnect] [-L path] [-o high[,low]] [-D seconds] [-R path]\n", name);
+	fprintf(stderr, "\t-d\trun as a daemon\n");
+	fprintf(stderr, "\t-m\tconnection engine, worker thread pool (default), epoll event loops or io_uring rings\n");
+	fprintf(stderr, "\t-t\tnumber of epoll or io_uring engine threads (default %d)\n", AESD_REACTOR_DEFAULT_THREADS);
+	fprintf(stderr, "\t-w\tnumber of worker threads of the pool (default %d)\n", AESD_POOL_DEFAULT_WORKERS);
+	fprintf(stderr, "\t-q\tconnections queued for the workers before accept() stops (default %d)\n", AESD_POOL_DEFAULT_DEPTH);
+	fprintf(stderr, "\t-s\tkeep connections open for any number of packets, closing them after this many idle seconds\n");
+	fprintf(stderr, "\t-g\tgroup commit, one committer thread writes the packets of all connections in batches (thread and epoll engines)\n");
+	fprintf(stderr, "\t-B\tstore backend, %s, %s or the in-memory ring of the driver's last writes (default %s)\n", AESD_STORE_DEVICE_PATH,
+		AESD_STORE_FILE_PATH, AESD_STORE_DEFAULT.name);
+	fprintf(stderr, "\t-C\tsend responses from a cached copy of the store, read again only after a write (server must be the only writer)\n");
+	fprintf(stderr, "\t-u\tbytes a subscriber (client sending AESDCHAR_SUBSCRIBE) may fall behind before -U applies (default %d)\n", AESD_SUBSCRIBE_DEFAULT_LIMIT);
+	fprintf(stderr, "\t-U\tslow subscribers skip packets (drop) or are disconnected (disconnect, default)\n");
+	fprintf(stderr, "\t-i\tseconds between two timestamps appended to the store, 0 disables them (default %d, none on the device)\n", TIMESTAMP_DEFAULT_INTERVAL);
+	fprintf(stderr, "\t-l\tlisteners sharing port 9000 with SO_REUSEPORT, each with its own acceptor or engine thread (default 1)\n");
+	fprintf(stderr, "\t-b\tlisten() backlog of every listener (default %d)\n", AESD_DEFAULT_BACKLOG);
+	fprintf(stderr, "\t-A\tpin the acceptor and engine threads to one CPU each\n");
+	fprintf(stderr, "\t-a\tunix socket answering every connection with a report of counters and latency percentiles\n");
+	fprintf(stderr, "\t-L\tappend log messages to this file instead of syslog\n");
+	fprintf(stderr, "\t-o\twith -C, bytes of responses an epoll connection may have queued before it stops reading, and below which it reads again (default %d,%d)\n",
+		AESD_OUTQ_DEFAULT_HIGH, AESD_OUTQ_DEFAULT_LOW);
+	fprintf(stderr, "\t-D\tseconds open connections get to finish after SIGTERM stopped accepting (default %d)\n", AESD_DRAIN_DEFAULT_DEADLINE);
+	fprintf(stderr, "\t-R\tunix socket for hot restarts, a server started with the same path takes over the listeners and this one drains\n");
+}
+// Driver Function
+int main(int argc, char **argv) {
+/************************************************************************************************Command Line Options********************************************************************************/
+	bool daemon_mode = false;
+	bool reactor_mode = false;
+#ifdef USE_IO_URING
+	bool uring_mode = false;
+#endif
+	int reactor_threads = AESD_REACTOR_DEFAULT_THREADS;
+	int pool_workers = AESD_POOL_DEFAULT_WORKERS;
+	int pool_depth = AESD_POOL_DEFAULT_DEPTH;
+	int listeners = 1;
+	int backlog = AESD_DEFAULT_BACKLOG;
+	bool output_given = false;
+	int opt;
+	config.timestamp_interval = -1;
+	config.backend = &AESD_STORE_DEFAULT;
+	config.subscribe_limit = AESD_SUBSCRIBE_DEFAULT_LIMIT;
+	config.output_high = AESD_OUTQ_DEFAULT_HIGH;
+	config.output_low = AESD_OUTQ_DEFAULT_LOW;
+	config.drain_deadline = AESD_DRAIN_DEFAULT_DEADLINE;
+	while((opt = getopt(argc, argv, "dm:t:w:q:s:gi:a:l:b:AB:Cu:U:L:o:D:R:")) != -1){
+		switch(opt){
+		case 'd':
+			daemon_mode = true;
+			break;
+		case 'm':
+			if(strcmp(optarg, "epoll") == 0){
+				reactor_mode = true;
+			}
+			else if(strcmp(optarg, "uring") == 0){
+#ifdef USE_IO_URING
+				uring_mode = true;
+#else
+				fprintf(stderr, "%s: built without io_uring support, rebuild with make USE_IO_URING=y\n", argv[0]);
+				exit(-1);
+#endif
+			}
+			else if(strcmp(optarg, "thread") != 0){
+				usage(argv[0]);
+				exit(-1);
+			}
+			break;
+		case 't':
+			reactor_threads = atoi(optarg);
+			if(reactor_threads < 1){
+				usage(argv[0]);
+				exit(-1);
+			}
+			break;
+		case 'w':
+			pool_workers = atoi(optarg);
+			if(pool_workers < 1){
+				usage(argv[0]);
+				exit(-1);
+			}
+			break;
+		case 'q':
+			pool_depth = atoi(optarg);
+			if(pool_depth < 1){
+				usage(argv[0]);
+				exit(-1);
+			}
+			break;
+		case 's':
+			config.session_timeout = atoi(optarg);
+			if(config.session_timeout < 1){
+				usage(argv[0]);
+				exit(-1);
+			}
+			break;
+		case 'g':
+			config.group_commit = true;
+			break;
+		case 'a':
+			config.admin_socket = optarg;
+			break;
+		case 'L':
+			config.log_path = optarg;
+			break;
+		case 'D':
+			config.drain_deadline = atoi(optarg);
+			if(config.drain_deadline < 0){
+				usage(argv[0]);
+				exit(-1);
+			}
+			break;
+		case 'R':
+			config.handoff_socket = optarg;
+			break;
+		case 'o':{
+			char *low;
+			config.output_high = strtoul(optarg, &low, 10);
+			config.output_low = (*low == ',') ? strtoul(low + 1, NULL, 10) : config.output_high / 4;
+			if((config.output_high < 1) || (config.output_low > config.output_high)){
+				usage(argv[0]);
+				exit(-1);
+			}
+			output_given = true;
+			break;
+		}
+		case 'l':
+			listeners = atoi(optarg);
+			if(listeners < 1){
+				usage(argv[0]);
+				exit(-1);
+			}
+			break;
+		case 'b':
+			backlog = atoi(optarg);
+			if(backlog < 1){
+				usage(argv[0]);
+				exit(-1);
+			}
+			break;
+		case 'A':
+			config.cpu_affinity = true;
+			break;
+		case 'C':
+			config.snapshot_cache = true;
+			break;
+		case 'u':
+			config.subscribe_limit = strtoul(optarg, NULL, 10);
+			if(config.subscribe_limit < 1){
+				usage(argv[0]);
+				exit(-1);
+			}
+			break;
+		case 'U':
+			if(strcmp(optarg, "drop") == 0){
+				config.subscribe_drop = true;
+			}
+			else if(strcmp(optarg, "disconnect") != 0){
+				usage(argv[0]);
+				exit(-1);
+			}
+			break;
+		case 'B':
+			config.backend = aesd_store_find(optarg);
+			if(!config.backend){
+				usage(argv[0]);
+				exit(-1);
+			}
+			break;
+		case 'i':
+			config.timestamp_interval = atoi(optarg);
+			if(config.timestamp_interval < 0){
+				usage(argv[0]);
+				exit(-1);
+			}
+			break;
+		default:
+			usage(argv[0]);
+			exit(-1);
+		}
+	}
+	if(config.timestamp_interval < 0){
+		config.timestamp_interval = config.backend->timestamps ? TIMESTAMP_DEFAULT_INTERVAL : 0;
+	}
+	// Without -C no packet is taken while a response is queued, there is never anything for the watermarks to bound
+	if(output_given && !config.snapshot_cache){
+		fprintf(stderr, "-o needs -C, only responses sent from the cached snapshot queue up\n");
+		usage(argv[0]);
+		exit(-1);
+	}
+/************************************************************************************************Signal Handler Invoke********************************************************************************/
+	if(aesd_drain_init() < 0){
+		exit(-1);
+	}
+	signal(SIGINT, signal_handler);
+	signal(SIGTERM, signal_handler);
+	// A client closing early must show up as EPIPE on send/sendfile instead of killing the server
+	signal(SIGPIPE, SIG_IGN);
+/*************************************************************************************************** Create the Sockets ******************************************************************************/
+	// Every listener is bound before daemonizing so that a port in use is reported to the caller
+	int *listener_fds = (int *) calloc((listeners > AESD_DRAIN_MAX_LISTENERS) ? listeners : AESD_DRAIN_MAX_LISTENERS, sizeof(int));
+	if(!listener_fds){
+		exit(-1);
+	}
+	// On a hot restart the listeners of the running server are taken over instead, with their backlog
+	int taken_over = config.handoff_socket ? aesd_drain_receive(config.handoff_socket, listener_fds) : 0;
+	if(taken_over < 0){
+		exit(-1);
+	}
+	if(taken_over > 0){
+		listeners = taken_over;
+		AESD_LOG(LOG_INFO, "Took %d listener(s) over from the running server", listeners);
+	}
+	else{
+		for(int i = 0; i < listeners; i++){
+			listener_fds[i] = open_listener(listeners > 1);
+			if(listener_fds[i] < 0){
+				exit(-1);
+			}
+		}
+		AESD_LOG(LOG_INFO, "Binded %d listener(s) to 9000", listeners);
+	}
+	sockfd = listener_fds[0];
 /*********************************************************************************** Perform the Daemonising Process *********************************************************************************/
 // The daemon process by accepting a statement -d as a command line argument to this file.
 /* Daemon Creation Process
@@ -240,87 +980,122 @@ int main(int argc, char **argv) {
 	change directory to /dev/null using chdir()
 	redirect to STDIN, STDOUT, and STDERR
 */
-	if(argc > 1){
-		if(strcmp(argv[1],"-d") == 0){
-			pid_t pid = fork();	//Create a child process using fork
-			if(pid < 0){
-				perror("Child Process not created: Daemon Process failed to create in step 1");
+	if(daemon_mode){
+		pid_t pid = fork();	//Create a child process using fork
+		if(pid < 0){
+			perror("Child Process not created: Daemon Process failed to create in step 1");
+			exit(-1);
+		}
+		else if(pid == 0){
+			if(setsid() < 0){
+				perror("Unable to set Id");
 				exit(-1);
 			}
-			else if(pid == 0){
-				if(setsid() < 0){
-					perror("Unable to set Id");
-					exit(-1);
-				}
-				
-				if(chdir("/") == -1){
-					perror("Unable to change directory");
-					exit(-1);
-				}
-				open("/dev/null",O_RDWR);
-				dup(0);
-				dup(0);
-				syslog(LOG_USER,"Daemon Created Successfully");
-			}
-			else{
-				exit(0);
+			
+			if(chdir("/") == -1){
+				perror("Unable to change directory");
+				exit(-1);
 			}
+			open("/dev/null",O_RDWR);
+			dup(0);
+			dup(0);
+			AESD_LOG(LOG_INFO,"Daemon Created Successfully");
+		}
+		else{
+			exit(0);
 		}
 	}
+	// Messages logged so far wait in the ring of this thread, the drainer of the daemon writes them
+	if(aesd_log_start(config.log_path) < 0){
+		exit(-1);
+	}
 
 /***************************************************************************************** Listening to the Server ***********************************************************************************/
-syslog(LOG_USER,"File successfully opened");
-int listener = listen(sockfd, 10);
-if(listener < 0){											// Backlog value set as 10 as prescribed in the Beej's user guide on sockets.
-	perror("Failed to execute in the listening process");
-	return -1;
+AESD_LOG(LOG_INFO,"File successfully opened");
+for(int i = 0; i < listeners; i++){
+	if(listen(listener_fds[i], backlog) < 0){							// Backlog defaults to 10 as prescribed in the Beej's user guide on sockets.
+		perror("Failed to execute in the listening process");
+		return -1;
+	}
 }
-syslog(LOG_USER, "Listening phase completed");
+AESD_LOG(LOG_INFO, "Listening phase completed, backlog %d", backlog);
 /***************************************************************************************** Accepting the Packets *************************************************************************************/
-socklen_t clientfd;
-struct sockaddr_in clientadd;
-bool alarm_flag = false;
 pthread_mutex_init(&mutex_lock, NULL);
-TAILQ_INIT(&head);
-	while (1) {
-	// Spin a new thread on every connection accept
-		thread_data_t *datap = (thread_data_t *) malloc(sizeof(thread_data_t));
-		clientfd = sizeof(clientadd);
-		datap->clientfd = accept(sockfd, (struct sockaddr *) &clientadd, &clientfd);
-
-		if (datap->clientfd == -1) {
-			perror("Error in accepting\n");
-			return -1;
-		}
-	// Convert IPv4 and IPv6 address from binary to text form
-	inet_ntop(clientadd.sin_family,(struct sockaddr *) &clientadd, datap->client_ipaddress, sizeof(datap->client_ipaddress));
-	syslog(LOG_DEBUG, "Accepted a connection from %s\n", datap->client_ipaddress);
-	// Once successful connection accept, create a thread to handle the thread_function
-	pthread_create(&(datap->thread), NULL, &thread_function, (void *)datap);
-	// Source: Queue.h functions handbook line 253
-	TAILQ_INSERT_TAIL(&head, datap, entries);
-	datap = NULL;
-	free(datap);
-	// Trigger an alarm for 10 seconds to efficiently call SIGALRM to append a timestamp
-	if (!alarm_flag) {
-		alarm_flag = true;
-		printf("alarm set\n");
-		alarm(10);
-	}
-	thread_data_t *entry = NULL;
-	// Source: Queue.h functions handbook line 181
-	TAILQ_FOREACH(entry, &head, entries)
-	{
-		printf("Join all the pthreads to prevent detached threads\n");
-		pthread_join(entry->thread, NULL);
-		if (entry->thread_complete_status) {
-			TAILQ_REMOVE(&head, entry, entries);
-			free(entry);
-			break;
-		}
-	}
-
-	}
+AESD_LOG(LOG_INFO, "Storing packets with the %s backend", config.backend->name);
+if(open_store(&timestamp_store) < 0){
+	return -1;
+}
+if(config.group_commit && (aesd_commit_start() < 0)){
+	return -1;
+}
+if(aesd_subscribe_start() < 0){
+	return -1;
+}
+// The server handing over still answers on the admin socket until the new one replaces it
+if(config.admin_socket && (aesd_metrics_serve(config.admin_socket, taken_over > 0) < 0)){
+	return -1;
+}
+// Timestamps start with the server instead of with the first connection
+pthread_t timestamp_writer;
+if((config.timestamp_interval > 0) && (pthread_create(&timestamp_writer, NULL, &timestamp_thread, NULL) != 0)){
+	perror("Unable to start the timestamp thread");
+	return -1;
+}
+if(aesd_drain_start(listener_fds, listeners) < 0){
+	return -1;
+}
+// Every listener needs at least one engine thread accepting on it
+if(reactor_threads < listeners){
+	reactor_threads = listeners;
+}
+if(reactor_mode){
+	AESD_LOG(LOG_INFO, "Serving connections with %d epoll event loops", reactor_threads);
+	aesd_reactor_run(listener_fds, listeners, reactor_threads);
 	close(sockfd);
-	close(fd);
+	close_store(&timestamp_store);
+	return -1;
+}
+#ifdef USE_IO_URING
+if(uring_mode){
+	AESD_LOG(LOG_INFO, "Serving connections with %d io_uring engines", reactor_threads);
+	aesd_uring_run(listener_fds, listeners, reactor_threads);
+	close(sockfd);
+	close_store(&timestamp_store);
+	return -1;
+}
+#endif
+// A fixed number of workers serve the connections queued by the acceptors
+aesd_pool_t *pool = aesd_pool_create(pool_workers, pool_depth, &serve_connection);
+if(!pool){
+	perror("Unable to create the worker pool");
+	return -1;
+}
+AESD_LOG(LOG_INFO, "Serving connections with %d workers, queue depth %d, %d acceptor(s)", pool_workers, pool_depth, listeners);
+acceptor_t *acceptors = (acceptor_t *) calloc(listeners, sizeof(acceptor_t));
+if(!acceptors){
+	return -1;
+}
+for(int i = 0; i < listeners; i++){
+	acceptors[i].pool = pool;
+	acceptors[i].sockfd = listener_fds[i];
+	aesd_drain_join();
+}
+// The main thread is the first acceptor, every other listener gets its own thread
+acceptors[0].thread = pthread_self();
+aesd_set_affinity(acceptors[0].thread, 0);
+for(int i = 1; i < listeners; i++){
+	if(pthread_create(&acceptors[i].thread, NULL, &accept_connections, &acceptors[i]) != 0){
+		perror("Unable to start an acceptor thread");
+		return -1;
+	}
+	aesd_set_affinity(acceptors[i].thread, i);
+}
+accept_connections(&acceptors[0]);
+// The drain thread ends the process once the connections are done, the workers keep serving them until then
+if(aesd_draining()){
+	pthread_exit(NULL);
+}
+close(sockfd);
+close_store(&timestamp_store);
+return -1;
 }
@@ -0,0 +1,231 @@
+/* Name	:	Sricharan Kidambi S
+   File	:	aesdsocket.h
+   Brief	:	Declarations shared between the aesdsocket front end (aesdsocket.c) and its connection handling engines
+*/
+
+#ifndef AESDSOCKET_H
+#define AESDSOCKET_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "aesd-store.h"
+#include "aesd-frame.h"
+#include "aesd-arena.h"
+
+// Backend used when -B is not given
+#define USE_AESD_CHAR_DEVICE 1
+#ifdef USE_AESD_CHAR_DEVICE
+	#define AESD_STORE_DEFAULT aesd_store_device
+#else
+	#define AESD_STORE_DEFAULT aesd_store_file
+#endif
+
+// Prefix of the AESDCHAR_IOCSEEKTO:X,Y command packet
+extern const char *perform_ioctl;
+
+// Default number of event loop threads used by the epoll and io_uring engines when -t is not given
+#define AESD_REACTOR_DEFAULT_THREADS 2
+
+// listen() backlog when -b is not given
+#define AESD_DEFAULT_BACKLOG 10
+
+// Largest single sendfile() or read()/send() step when streaming the store back to a client
+#define STORE_STREAM_CHUNK 65536
+
+// Progress of sending the store back to one client
+typedef struct store_stream
+{
+	/**
+	 * Bounce buffer used when the store can not be spliced, allocated on first use with store_stream_bounce()
+	 */
+	char *bounce;
+	size_t bounce_bytes;
+	size_t bounce_sent;
+	/**
+	 * With -C the response is sent from this snapshot instead, held until the response is complete
+	 */
+	struct aesd_snapshot *snapshot;
+	/**
+	 * The response goes out as AESD_OP_DATA frames (aesd-frame.h), set by the engine for binary connections.
+	 * Framed chunks always go through the bounce buffer, each one behind its header.
+	 */
+	bool framed;
+	/**
+	 * The empty frame ending a framed response is in the bounce buffer
+	 */
+	bool trailer;
+	/**
+	 * Arena of the connection the bounce buffer is taken from, set by the engine after store_stream_init().
+	 * NULL uses malloc().
+	 */
+	aesd_arena_t *arena;
+	/**
+	 * Bytes of responses sent through this stream state, including the snapshot segments of the output queue.
+	 * Lets an engine tell a client reading a large response slowly from an idle one.
+	 */
+	uint64_t sent;
+}store_stream_t;
+
+// Run time options of the server, filled from the command line by main() before any connection is served
+typedef struct aesd_config
+{
+	/**
+	 * Seconds a client session may stay without sending a packet, 0 keeps the one packet per connection protocol
+	 */
+	int session_timeout;
+	/**
+	 * Store writes of all connections go through the group commit stage (aesd-commit.c)
+	 */
+	bool group_commit;
+	/**
+	 * Seconds between two timestamps appended by the timestamp thread, 0 when no timestamps are written
+	 */
+	int timestamp_interval;
+	/**
+	 * Path of the unix socket serving the metrics report, NULL when it is not served
+	 */
+	const char *admin_socket;
+	/**
+	 * Acceptor and engine threads are pinned to one CPU each, see aesd_set_affinity()
+	 */
+	bool cpu_affinity;
+	/**
+	 * Where packets are stored, chosen with -B
+	 */
+	const aesd_store_backend_t *backend;
+	/**
+	 * Responses are sent from a cached snapshot of the store, see aesd-snapshot.c
+	 */
+	bool snapshot_cache;
+	/**
+	 * Bytes a subscriber may fall behind the published packets, see aesd-subscribe.c
+	 */
+	size_t subscribe_limit;
+	/**
+	 * A subscriber over the limit skips packets instead of being disconnected
+	 */
+	bool subscribe_drop;
+	/**
+	 * File the log drainer appends to, NULL for syslog, see aesd-log.c
+	 */
+	const char *log_path;
+	/**
+	 * Watermarks in bytes of the output queue of an epoll connection, see aesd-outq.h
+	 */
+	size_t output_high;
+	size_t output_low;
+	/**
+	 * Seconds open connections get to finish once a drain started, see aesd-drain.c
+	 */
+	int drain_deadline;
+	/**
+	 * Unix socket the listening sockets are taken over from and handed over to on a hot restart, NULL when unused
+	 */
+	const char *handoff_socket;
+}aesd_config_t;
+
+extern aesd_config_t config;
+
+// Serializes writes to the store between all connections, regardless of the engine handling them
+extern pthread_mutex_t mutex_lock;
+
+/* Function	: open_store / close_store
+ * Purpose	: open a handle of the config.backend store for one connection, every connection owns its own handle so
+ *		  that the AESDCHAR_IOCSEEKTO position of one client does not move the position of another.
+ *		  close_store() may be called on a handle which failed to open.
+ * Returns	: 0 on success, -1 on failure
+ */
+int open_store(aesd_store_t *store);
+void close_store(aesd_store_t *store);
+
+/* Function	: store_seek
+ * Purpose	: recognize a read command and set the response window, store->pos and store->end. That is a text
+ *		  AESDCHAR_IOCSEEKTO:X,Y, AESDCHAR_IOCRANGE:X,Y,N or AESDCHAR_IOCRANGEBYTES:X,Y,L packet moved with the
+ *		  backend's seek (backends without seek take the packet as data), or an AESD_OP_SEEK_READ,
+ *		  AESD_OP_RANGE_READ or AESD_OP_ENTRY_READ frame.
+ * Parameters	: store handle from open_store(), aesd_opcode_t of the packet (rx->opcode), the packet and its length
+ * Returns	: 1 when the packet was a read command, 0 when it is data to be written, -1 when the command failed
+ */
+int store_seek(aesd_store_t *store, uint8_t opcode, const char *packet, size_t len);
+
+/* Function	: store_append
+ * Purpose	: append data to the store, ordered with every other writer. The data is written under mutex_lock, or
+ *		  by the committer when group commit is enabled.
+ * Parameters	: store handle from open_store(), the data and its length
+ * Returns	: 0 on success, -1 on failure
+ */
+int store_append(aesd_store_t *store, const char *data, size_t len);
+
+/* Function	: store_packet
+ * Purpose	: apply one complete packet (terminated by '\n', or one frame) to the store. Read commands go to
+ *		  store_seek(), anything else is appended under mutex_lock, or by the committer when group commit is
+ *		  enabled. On return store->pos and store->end are the window of the response.
+ * Parameters	: store handle from open_store(), aesd_opcode_t of the packet, the packet and its length
+ * Returns	: 0 on success, -1 on failure
+ */
+int store_packet(aesd_store_t *store, uint8_t opcode, const char *packet, size_t len);
+
+/* Function	: store_stream_limit
+ * Purpose	: largest read of the response which stays inside store->end, at most STORE_STREAM_CHUNK
+ * Returns	: the byte count, 0 when the window is exhausted
+ */
+size_t store_stream_limit(const aesd_store_t *store);
+
+/* Function	: store_stream_init / store_stream_free
+ * Purpose	: prepare a store_stream_t and release its bounce buffer and snapshot
+ */
+void store_stream_init(store_stream_t *stream);
+void store_stream_free(store_stream_t *stream);
+
+/* Function	: store_stream_bounce
+ * Purpose	: allocate the bounce buffer, AESD_FRAME_HEADER_SIZE + STORE_STREAM_CHUNK bytes, unless it exists already.
+ *		  It comes from stream->arena when there is one.
+ * Returns	: 0 on success, -1 when memory could not be allocated
+ */
+int store_stream_bounce(store_stream_t *stream);
+
+/* Function	: store_stream_send
+ * Purpose	: send the store from store->pos to store->end or its end, advancing store->pos. The data of a descriptor
+ *		  backed store goes to the socket with sendfile(), when the store can not be spliced (/dev/aesdchar has
+ *		  no splice_read), is in memory or the response is framed it is copied through the bounce buffer in
+ *		  STORE_STREAM_CHUNK steps instead. With config.snapshot_cache unframed data comes from the cached
+ *		  snapshot and the store is not read at all while the snapshot is current.
+ * Parameters	: stream state of this response, store handle, client socket (blocking or non-blocking)
+ * Returns	: 1 when everything was sent, 0 when a non-blocking socket is full and the call has to be repeated once
+ *		  it is writable, -1 on error
+ */
+int store_stream_send(store_stream_t *stream, aesd_store_t *store, int clientfd);
+
+/* Function	: aesd_exit
+ * Purpose	: release what the server holds and exit. After a handoff the store file and the admin socket are left
+ *		  to the new server.
+ */
+void aesd_exit(void);
+
+/* Function	: aesd_set_affinity
+ * Purpose	: with config.cpu_affinity pin a thread to CPU index modulo the number of online CPUs, nothing otherwise
+ * Parameters	: the thread, its index among the acceptor or engine threads
+ */
+void aesd_set_affinity(pthread_t thread, int index);
+
+/* Function	: aesd_reactor_run
+ * Purpose	: serve connections on the listening sockets with nthreads edge-triggered epoll event loops. Loop i
+ *		  accepts on listener i modulo nlisteners. Does not return unless the event loops could not be started.
+ * Parameters	: bound and listening sockets, their number, number of event loop threads (at least nlisteners)
+ * Returns	: -1 on failure
+ */
+int aesd_reactor_run(const int *sockfds, int nlisteners, int nthreads);
+
+/* Function	: aesd_uring_run
+ * Purpose	: serve connections on the listening sockets with nthreads io_uring engine threads, engine i accepts on
+ *		  listener i modulo nlisteners. Only available when the server is built with USE_IO_URING=y. Does not
+ *		  return unless the engine could not be started.
+ * Parameters	: bound and listening sockets, their number, number of engine threads (at least nlisteners)
+ * Returns	: -1 on failure
+ */
+int aesd_uring_run(const int *sockfds, int nlisteners, int nthreads);
+
+#endif /* AESDSOCKET_H */
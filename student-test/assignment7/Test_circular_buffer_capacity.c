@@ -0,0 +1,146 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "../../aesd-char-driver/aesd-circular-buffer.h"
+
+/**
+* Tests of the run time capacity of the circular buffer: aesd_circular_buffer_init_capacity(),
+* aesd_circular_buffer_resize() and AESDCHAR_MAX_CAPACITY, as used by the capacity module parameter and
+* AESDCHAR_IOCCAPACITY.
+*/
+static const char *packets[] = {
+    "write0\n", "write1\n", "write2\n", "write3\n", "write4\n",
+    "write5\n", "write6\n", "write7\n", "write8\n", "write9\n",
+};
+
+static const char *write_packet(struct aesd_circular_buffer *buffer, const char *writestr)
+{
+    struct aesd_buffer_entry entry;
+    entry.buffptr = writestr;
+    entry.size = strlen(writestr);
+    return aesd_circular_buffer_add_entry(buffer, &entry);
+}
+
+/**
+* Checks the entry found at @param char_offset holds @param expected, at @param expected_offset within it
+*/
+static void verify_find(struct aesd_circular_buffer *buffer, size_t char_offset, const char *expected, size_t expected_offset)
+{
+    size_t offset_rtn = 0;
+    struct aesd_buffer_entry *entry = aesd_circular_buffer_find_entry_offset_for_fpos(buffer, char_offset, &offset_rtn);
+    TEST_ASSERT_NOT_NULL_MESSAGE(entry, "No entry found for an offset inside the buffer");
+    TEST_ASSERT_EQUAL_PTR_MESSAGE(expected, entry->buffptr, "The offset resolved to the wrong entry");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(expected_offset, offset_rtn, "The offset within the entry is wrong");
+}
+
+void test_circular_buffer_init_default_capacity()
+{
+    struct aesd_circular_buffer buffer;
+    aesd_circular_buffer_init(&buffer);
+    TEST_ASSERT_EQUAL_UINT32(AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, buffer.capacity);
+    TEST_ASSERT_EQUAL_INT(0, get_populated_nodes(&buffer));
+    for (int i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i++) {
+        TEST_ASSERT_NULL(write_packet(&buffer, packets[i]));
+    }
+    TEST_ASSERT_TRUE(buffer.full);
+    // The eleventh write evicts the first one and hands it back to be freed
+    TEST_ASSERT_EQUAL_PTR(packets[0], write_packet(&buffer, packets[0]));
+    verify_find(&buffer, 0, packets[1], 0);
+}
+
+void test_circular_buffer_resize_shrink_while_full()
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry entries[4];
+    aesd_circular_buffer_init(&buffer);
+    for (int i = 0; i < 10; i++) {
+        write_packet(&buffer, packets[i]);
+    }
+    TEST_ASSERT_TRUE(buffer.full);
+    // The default storage belongs to the buffer, there is nothing for the caller to free
+    TEST_ASSERT_NULL(aesd_circular_buffer_resize(&buffer, entries, 4));
+    TEST_ASSERT_EQUAL_UINT32(4, buffer.capacity);
+    TEST_ASSERT_EQUAL_INT(4, get_populated_nodes(&buffer));
+    TEST_ASSERT_TRUE(buffer.full);
+    TEST_ASSERT_EQUAL_UINT32(4 * strlen(packets[0]), get_the_total_buffer_size(&buffer));
+    // The newest four writes are kept, oldest first
+    verify_find(&buffer, 0, packets[6], 0);
+    verify_find(&buffer, 3 * strlen(packets[0]) + 2, packets[9], 2);
+    TEST_ASSERT_EQUAL_INT64(7, aesd_circular_buffer_llseek(&buffer, 1, 0));
+    // A full shrunk buffer evicts its oldest entry again
+    TEST_ASSERT_EQUAL_PTR(packets[6], write_packet(&buffer, packets[0]));
+    verify_find(&buffer, 0, packets[7], 0);
+    verify_find(&buffer, 3 * strlen(packets[0]), packets[0], 0);
+}
+
+void test_circular_buffer_resize_grow_after_wrap()
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry small[4];
+    struct aesd_buffer_entry large[8];
+    aesd_circular_buffer_init_capacity(&buffer, small, 4);
+    for (int i = 0; i < 6; i++) {
+        write_packet(&buffer, packets[i]);
+    }
+    // Six writes into four entries wrapped around, the oldest entry is no longer at index 0
+    TEST_ASSERT_TRUE(buffer.full);
+    TEST_ASSERT_NOT_EQUAL(0, buffer.out_offs);
+    TEST_ASSERT_EQUAL_PTR(small, aesd_circular_buffer_resize(&buffer, large, 8));
+    TEST_ASSERT_EQUAL_UINT32(8, buffer.capacity);
+    TEST_ASSERT_FALSE(buffer.full);
+    TEST_ASSERT_EQUAL_INT(4, get_populated_nodes(&buffer));
+    verify_find(&buffer, 0, packets[2], 0);
+    verify_find(&buffer, 3 * strlen(packets[0]), packets[5], 0);
+    // Four more writes fill the grown buffer without evicting anything
+    for (int i = 6; i < 10; i++) {
+        TEST_ASSERT_NULL(write_packet(&buffer, packets[i]));
+    }
+    TEST_ASSERT_TRUE(buffer.full);
+    verify_find(&buffer, 0, packets[2], 0);
+    verify_find(&buffer, 7 * strlen(packets[0]) + 6, packets[9], 6);
+    TEST_ASSERT_EQUAL_PTR(packets[2], write_packet(&buffer, packets[0]));
+}
+
+void test_circular_buffer_capacity_one()
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry first[1];
+    struct aesd_buffer_entry second[1];
+    size_t offset_rtn;
+    aesd_circular_buffer_init_capacity(&buffer, first, 1);
+    TEST_ASSERT_NULL(write_packet(&buffer, packets[0]));
+    TEST_ASSERT_TRUE(buffer.full);
+    TEST_ASSERT_EQUAL_PTR(packets[0], write_packet(&buffer, packets[1]));
+    verify_find(&buffer, 0, packets[1], 0);
+    TEST_ASSERT_NULL(aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, strlen(packets[1]), &offset_rtn));
+    TEST_ASSERT_EQUAL_PTR(first, aesd_circular_buffer_resize(&buffer, second, 1));
+    TEST_ASSERT_TRUE(buffer.full);
+    TEST_ASSERT_EQUAL_INT(1, get_populated_nodes(&buffer));
+    TEST_ASSERT_EQUAL_INT64(3, aesd_circular_buffer_llseek(&buffer, 0, 3));
+    TEST_ASSERT_EQUAL_INT64(-EINVAL, aesd_circular_buffer_llseek(&buffer, 1, 0));
+    TEST_ASSERT_EQUAL_PTR(packets[1], write_packet(&buffer, packets[2]));
+    verify_find(&buffer, 6, packets[2], 6);
+}
+
+void test_circular_buffer_shrink_to_empty_buffer()
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry entries[2];
+    size_t offset_rtn;
+    aesd_circular_buffer_init(&buffer);
+    TEST_ASSERT_NULL(aesd_circular_buffer_resize(&buffer, entries, 2));
+    TEST_ASSERT_FALSE(buffer.full);
+    TEST_ASSERT_EQUAL_INT(0, get_populated_nodes(&buffer));
+    TEST_ASSERT_EQUAL_UINT32(0, get_the_total_buffer_size(&buffer));
+    TEST_ASSERT_NULL(aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, 0, &offset_rtn));
+}
+
+void test_circular_buffer_max_capacity()
+{
+    // The largest entry array fits into its byte budget, one more entry would not
+    TEST_ASSERT_TRUE((size_t) AESDCHAR_MAX_CAPACITY * sizeof(struct aesd_buffer_entry) <= AESDCHAR_MAX_ENTRY_ARRAY_SIZE);
+    TEST_ASSERT_TRUE(((size_t) AESDCHAR_MAX_CAPACITY + 1) * sizeof(struct aesd_buffer_entry) > AESDCHAR_MAX_ENTRY_ARRAY_SIZE);
+    TEST_ASSERT_TRUE(AESDCHAR_MAX_CAPACITY >= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED);
+}
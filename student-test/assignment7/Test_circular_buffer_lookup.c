@@ -0,0 +1,189 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "../../aesd-char-driver/aesd-circular-buffer.h"
+
+/**
+* Tests of the byte position index of the circular buffer: offset lookups, llseek and range ends relative to the
+* oldest entry still held, before and after older entries are evicted.
+*/
+static const char *packets[] = {
+    "a\n", "bc\n", "def\n", "ghij\n", "klmno\n", "pqrstu\n", "vwxyz01\n",
+    "2\n", "34\n", "567\n", "89AB\n", "CDEFG\n", "HIJKLM\n",
+};
+#define PACKET_COUNT (sizeof(packets) / sizeof(packets[0]))
+
+static const char *write_packet(struct aesd_circular_buffer *buffer, const char *writestr)
+{
+    struct aesd_buffer_entry entry;
+    entry.buffptr = writestr;
+    entry.size = strlen(writestr);
+    return aesd_circular_buffer_add_entry(buffer, &entry);
+}
+
+/**
+* Writes packets @param first up to but not including @param last into @param buffer
+*/
+static void write_packets(struct aesd_circular_buffer *buffer, unsigned int first, unsigned int last)
+{
+    for (unsigned int i = first; i < last; i++) {
+        write_packet(buffer, packets[i]);
+    }
+}
+
+static void verify_find(struct aesd_circular_buffer *buffer, size_t char_offset, const char *expected, size_t expected_offset)
+{
+    size_t offset_rtn = 0;
+    struct aesd_buffer_entry *entry = aesd_circular_buffer_find_entry_offset_for_fpos(buffer, char_offset, &offset_rtn);
+    TEST_ASSERT_NOT_NULL_MESSAGE(entry, "No entry found for an offset inside the buffer");
+    TEST_ASSERT_EQUAL_PTR_MESSAGE(expected, entry->buffptr, "The offset resolved to the wrong entry");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(expected_offset, offset_rtn, "The offset within the entry is wrong");
+}
+
+/**
+* Checks every byte of @param buffer resolves to packets @param first up to but not including @param last
+*/
+static void verify_every_offset(struct aesd_circular_buffer *buffer, unsigned int first, unsigned int last)
+{
+    size_t char_offset = 0;
+    size_t offset_rtn;
+    for (unsigned int i = first; i < last; i++) {
+        for (size_t byte = 0; byte < strlen(packets[i]); byte++) {
+            verify_find(buffer, char_offset++, packets[i], byte);
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT32(char_offset, get_the_total_buffer_size(buffer));
+    TEST_ASSERT_NULL(aesd_circular_buffer_find_entry_offset_for_fpos(buffer, char_offset, &offset_rtn));
+}
+
+void test_circular_buffer_populated_nodes()
+{
+    struct aesd_circular_buffer buffer;
+    aesd_circular_buffer_init(&buffer);
+    TEST_ASSERT_EQUAL_INT(0, get_populated_nodes(&buffer));
+    TEST_ASSERT_FALSE(buffer.full);
+    TEST_ASSERT_EQUAL_UINT32(0, get_the_total_buffer_size(&buffer));
+    write_packets(&buffer, 0, 3);
+    TEST_ASSERT_EQUAL_INT(3, get_populated_nodes(&buffer));
+    TEST_ASSERT_FALSE(buffer.full);
+    write_packets(&buffer, 3, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED);
+    TEST_ASSERT_EQUAL_INT(AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, get_populated_nodes(&buffer));
+    TEST_ASSERT_TRUE(buffer.full);
+    // Evicting keeps the buffer full
+    write_packets(&buffer, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, PACKET_COUNT);
+    TEST_ASSERT_EQUAL_INT(AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, get_populated_nodes(&buffer));
+    TEST_ASSERT_TRUE(buffer.full);
+}
+
+void test_circular_buffer_find_at_entry_boundaries()
+{
+    struct aesd_circular_buffer buffer;
+    aesd_circular_buffer_init(&buffer);
+    write_packets(&buffer, 0, 3);
+    // First byte, newline byte and the byte after the newline of each entry
+    verify_find(&buffer, 0, packets[0], 0);
+    verify_find(&buffer, 1, packets[0], 1);
+    verify_find(&buffer, 2, packets[1], 0);
+    verify_find(&buffer, 4, packets[1], 2);
+    verify_find(&buffer, 5, packets[2], 0);
+    verify_find(&buffer, 8, packets[2], 3);
+    verify_every_offset(&buffer, 0, 3);
+}
+
+void test_circular_buffer_find_skips_empty_entries()
+{
+    struct aesd_circular_buffer buffer;
+    size_t offset_rtn;
+    aesd_circular_buffer_init(&buffer);
+    write_packet(&buffer, packets[0]);
+    write_packet(&buffer, "");
+    write_packet(&buffer, packets[1]);
+    write_packet(&buffer, "");
+    // The byte after the first entry belongs to the next entry holding data
+    verify_find(&buffer, 2, packets[1], 0);
+    TEST_ASSERT_NULL(aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, 5, &offset_rtn));
+}
+
+void test_circular_buffer_find_after_wrap()
+{
+    struct aesd_circular_buffer buffer;
+    aesd_circular_buffer_init(&buffer);
+    write_packets(&buffer, 0, PACKET_COUNT);
+    // The three oldest packets were evicted, the oldest entry left sits in the middle of the array
+    TEST_ASSERT_EQUAL_UINT32(PACKET_COUNT - AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, buffer.out_offs);
+    TEST_ASSERT_EQUAL_UINT64(strlen(packets[0]) + strlen(packets[1]) + strlen(packets[2]), buffer.base);
+    verify_every_offset(&buffer, PACKET_COUNT - AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, PACKET_COUNT);
+}
+
+void test_circular_buffer_find_as_base_advances()
+{
+    struct aesd_circular_buffer buffer;
+    aesd_circular_buffer_init(&buffer);
+    write_packets(&buffer, 0, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED);
+    // Each eviction moves offset 0 to the next oldest packet
+    for (unsigned int i = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i < PACKET_COUNT; i++) {
+        write_packet(&buffer, packets[i]);
+        verify_find(&buffer, 0, packets[i - AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 1], 0);
+        verify_every_offset(&buffer, i - AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 1, i + 1);
+    }
+}
+
+void test_circular_buffer_llseek_after_eviction()
+{
+    struct aesd_circular_buffer buffer;
+    unsigned int oldest = PACKET_COUNT - AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    aesd_circular_buffer_init(&buffer);
+    write_packets(&buffer, 0, PACKET_COUNT);
+    // Positions count from the oldest entry still held, not from the first write
+    TEST_ASSERT_EQUAL_INT64(0, aesd_circular_buffer_llseek(&buffer, 0, 0));
+    TEST_ASSERT_EQUAL_INT64(strlen(packets[oldest]) + strlen(packets[oldest + 1]) + 1,
+            aesd_circular_buffer_llseek(&buffer, 2, 1));
+    TEST_ASSERT_EQUAL_INT64(get_the_total_buffer_size(&buffer) - 1,
+            aesd_circular_buffer_llseek(&buffer, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - 1,
+            strlen(packets[PACKET_COUNT - 1]) - 1));
+    TEST_ASSERT_EQUAL_INT64(-EINVAL, aesd_circular_buffer_llseek(&buffer, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, 0));
+    TEST_ASSERT_EQUAL_INT64(-EINVAL, aesd_circular_buffer_llseek(&buffer, 0, strlen(packets[oldest])));
+}
+
+void test_circular_buffer_entries_end_after_eviction()
+{
+    struct aesd_circular_buffer buffer;
+    unsigned int oldest = PACKET_COUNT - AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    aesd_circular_buffer_init(&buffer);
+    write_packets(&buffer, 0, PACKET_COUNT);
+    TEST_ASSERT_EQUAL_INT64(strlen(packets[oldest]), aesd_circular_buffer_entries_end(&buffer, 0, 1));
+    // Two entries from the second oldest end behind the third oldest
+    TEST_ASSERT_EQUAL_INT64(strlen(packets[oldest]) + strlen(packets[oldest + 1]) + strlen(packets[oldest + 2]),
+            aesd_circular_buffer_entries_end(&buffer, 1, 2));
+    // A range running past the newest entry ends with it
+    TEST_ASSERT_EQUAL_INT64(get_the_total_buffer_size(&buffer), aesd_circular_buffer_entries_end(&buffer, 8, 5));
+    TEST_ASSERT_EQUAL_INT64(-EINVAL, aesd_circular_buffer_entries_end(&buffer, 0, 0));
+    TEST_ASSERT_EQUAL_INT64(-EINVAL, aesd_circular_buffer_entries_end(&buffer, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, 1));
+}
+
+void test_circular_buffer_read_across_entries()
+{
+    struct aesd_circular_buffer buffer;
+    char expected[64] = "";
+    char result[64];
+    size_t total, copied, offset_rtn, count;
+    struct aesd_buffer_entry *entry;
+    aesd_circular_buffer_init(&buffer);
+    write_packets(&buffer, 0, PACKET_COUNT);
+    for (unsigned int i = PACKET_COUNT - AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i < PACKET_COUNT; i++) {
+        strcat(expected, packets[i]);
+    }
+    total = get_the_total_buffer_size(&buffer);
+    TEST_ASSERT_EQUAL_UINT32(strlen(expected), total);
+    // Copy entry by entry from the middle of the oldest one, the way a read() larger than an entry does
+    copied = 1;
+    while ((entry = aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, copied, &offset_rtn)) != NULL) {
+        count = entry->size - offset_rtn;
+        memcpy(result + copied - 1, entry->buffptr + offset_rtn, count);
+        copied += count;
+    }
+    TEST_ASSERT_EQUAL_UINT32(total, copied);
+    TEST_ASSERT_EQUAL_MEMORY(expected + 1, result, total - 1);
+}